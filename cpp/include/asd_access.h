@@ -24,10 +24,16 @@ but WITHOUT ANY WARRANTY of any kind.
 #include <boost/intrusive/slist.hpp>
 
 #include "boolean_enum.h"
+#include <atomic>
+#include <condition_variable>
 #include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
 
 #include "asd_client.h"
 #include "osd_info.h"
+#include "statistics.h"
 
 namespace alba {
 namespace asd {
@@ -35,10 +41,99 @@ namespace asd {
 using namespace std::chrono;
 using asd_client::Asd_client;
 
+/* the read timeout of an asd follows its own tail latency:
+   multiplier * p99, bounded by floor and ceiling.
+   the static timeout is used until there are enough samples. */
+struct AdaptiveTimeout {
+  double multiplier = 0; // 0 disables
+  steady_clock::duration floor = milliseconds(5);
+  steady_clock::duration ceiling = milliseconds(250);
+  size_t min_samples = 32;
+};
+
+/* trips after failure_threshold failures without a success in between.
+   while open nothing goes through until the backoff passed, then one
+   probe does (half open). its success closes the breaker, its failure
+   opens it again for twice as long, up to max_backoff.
+   not thread safe, the pool's lock protects it. */
+class CircuitBreaker {
+public:
+  enum class State { closed, open, half_open };
+
+  CircuitBreaker(size_t failure_threshold = 15,
+                 steady_clock::duration backoff = seconds(1),
+                 steady_clock::duration max_backoff = seconds(120));
+
+  // claims the probe when it's time for one
+  bool allow(steady_clock::time_point now);
+  // same, without claiming anything
+  bool would_allow(steady_clock::time_point now) const;
+
+  void success();
+  void failure(steady_clock::time_point now);
+
+  State state() const { return _state; }
+  uint64_t trips() const { return _trips; }
+
+private:
+  const size_t _threshold;
+  const steady_clock::duration _min_backoff;
+  const steady_clock::duration _max_backoff;
+  steady_clock::duration _backoff;
+  State _state = State::closed;
+  size_t _failures = 0;
+  steady_clock::time_point _until;
+  uint64_t _trips = 0;
+
+  void _open(steady_clock::time_point now);
+};
+
+std::ostream &operator<<(std::ostream &, const CircuitBreaker::State &);
+
+struct Endpoint {
+  transport::Kind kind;
+  std::string ip;
+  std::string port;
+  bool rora; // advertised in the osd's capabilities
+};
+
+// the rora endpoints the osd advertises first, then its regular ones
+std::vector<Endpoint> endpoints(const proxy_protocol::OsdInfo &,
+                                const proxy_protocol::OsdCapabilities &);
+
+struct ConnectionStats {
+  size_t idle;     // pooled, over all pools
+  size_t in_use;   // handed out to reads, over all pools
+  uint64_t opened; // since the start
+  uint64_t closed; // by the pools; connections dropped after a failed read
+                   // aren't counted
+  size_t open_breakers;
+  size_t half_open_breakers;
+  uint64_t breaker_trips; // since the start
+};
+
+struct ConnectionCounters {
+  std::atomic<size_t> idle{0};
+  std::atomic<size_t> in_use{0};
+  std::atomic<uint64_t> opened{0};
+  std::atomic<uint64_t> closed{0};
+};
+
+class ConnectionPools;
+
+/* the capacity follows demand: it grows (up to the size the pool was made
+   with) when reads found the pool empty, and shrinks when the asd wasn't
+   used between two maintenance passes, down to 0 (no idle connection)
+   after idle_passes of them in a row. */
 class ConnectionPool {
 public:
   ConnectionPool(std::unique_ptr<proxy_protocol::OsdInfo>, size_t,
-                 std::chrono::steady_clock::duration timeout);
+                 std::chrono::steady_clock::duration timeout,
+                 const AdaptiveTimeout &adaptive = AdaptiveTimeout(),
+                 size_t min_size = 0, ConnectionPools *owner = nullptr,
+                 const proxy_protocol::OsdCapabilities &caps =
+                     proxy_protocol::OsdCapabilities(),
+                 double hedge_percentile = 0);
 
   ~ConnectionPool();
 
@@ -46,6 +141,8 @@ public:
 
   ConnectionPool &operator=(const ConnectionPool &) = delete;
 
+  // none when the breaker is open. when the pool is empty, and a thread
+  // maintains it, none too: that thread connects, not the caller
   std::unique_ptr<Asd_client> get_connection();
 
   void capacity(const size_t);
@@ -55,8 +152,44 @@ public:
   size_t size() const;
 
   void release_connection(std::unique_ptr<Asd_client>);
+  // for a connection that can't be reused, after a failed or cancelled
+  // read
+  void drop_connection(std::unique_ptr<Asd_client>);
   void report_failure();
 
+  // the asd's circuit breaker is open: get_connection won't hand out
+  // connections
+  bool is_disqualified() const;
+  CircuitBreaker::State breaker_state() const;
+  uint64_t breaker_trips() const;
+
+  // duration of one request on one of the connections, or the timeout
+  // when it timed out
+  void report_latency(steady_clock::duration);
+
+  // the timeout connections are handed out with. the adaptive one is
+  // recomputed every refresh_samples latencies, not per connection
+  steady_clock::duration timeout() const;
+  static const size_t refresh_samples = 16;
+
+  // the hedge_percentile of the latencies, refreshed along with the
+  // timeout. none when disabled or without enough samples yet
+  boost::optional<steady_clock::duration> hedge_latency() const;
+
+  // probes the idle connections with get_version, one at a time and the
+  // longest idle first, drops the broken ones and connects until there
+  // are min_size again (if the asd was read from since the last pass).
+  // when the breaker is due for a probe, this is it.
+  void maintain();
+  static const size_t idle_passes = 6;
+  // only connects, up to min_size or as many as reads found the pool
+  // empty since the last maintain
+  void refill();
+
+  steady_clock::time_point last_used() const;
+  // false if there was no idle connection
+  bool close_idle();
+
 private:
   mutable std::mutex _mutex;
 
@@ -65,34 +198,115 @@ private:
 
   std::unique_ptr<proxy_protocol::OsdInfo> config_;
   size_t capacity_;
+  const size_t max_capacity_;
+  const size_t min_size_;
+
+  ConnectionPools *owner_;
+  ConnectionCounters local_counters_;
+  ConnectionCounters &counters_; // the owner's, if there is one
+
+  size_t idle_passes_ = 0;
+  // demand since the last maintenance
+  size_t gets_ = 0;
+  size_t misses_ = 0;
+  bool maintained_ = false;
+  // a connection is out for a probe; misses meanwhile aren't demand
+  bool probing_ = false;
+  steady_clock::time_point last_used_;
 
   std::chrono::steady_clock::duration timeout_;
-
-  std::unique_ptr<Asd_client> make_one_() const;
+  const AdaptiveTimeout adaptive_;
+  statistics::LatencyWindow latencies_;
+  std::atomic<size_t> samples_;
+  // 0 until there are min_samples
+  std::atomic<steady_clock::rep> adaptive_timeout_;
+  const double hedge_percentile_;
+  std::atomic<steady_clock::rep> hedge_latency_; // 0: none
+  void refresh_latencies_();
+
+  /* connections are spread over the preferred endpoints, and fall back
+     to the others. endpoints that failed to connect are tried last for
+     a while. the first race_width of them are connected to concurrently,
+     staggered by a quarter of the timeout. */
+  static const size_t race_width = 3;
+  std::vector<Endpoint> endpoints_;
+  std::vector<steady_clock::time_point> failed_until_;
+  size_t next_endpoint_ = 0;
+  std::unique_ptr<Asd_client> make_one_();
+  // connects until there are n idle connections, false if none could be
+  // opened
+  bool fill_(size_t n);
 
   static std::unique_ptr<Asd_client> pop_(Connections &);
+  static std::unique_ptr<Asd_client> pop_back_(Connections &);
+  // false (and the connection closed) if the pool is full
+  bool keep_(std::unique_ptr<Asd_client>);
 
   static void clear_(Connections &);
 
-  int _fast_path_failures;
-  steady_clock::time_point _failure_time;
+  void report_failure_();
+  bool disqualified_() const;
+
+  CircuitBreaker breaker_;
 };
 
 class ConnectionPools {
 public:
   ConnectionPool *
   get_connection_pool(const proxy_protocol::OsdInfo &, int connection_pool_size,
-                      std::chrono::steady_clock::duration timeout);
-
-  ConnectionPools() = default;
+                      std::chrono::steady_clock::duration timeout,
+                      const AdaptiveTimeout &adaptive = AdaptiveTimeout(),
+                      size_t min_size = 0,
+                      const proxy_protocol::OsdCapabilities &caps =
+                          proxy_protocol::OsdCapabilities(),
+                      double hedge_percentile = 0);
+
+  // a thread maintains all pools every interval, and when asked to.
+  // it also closes idle connections of the least recently used pools
+  // while there are more than the budget open, idle or in use. it doesn't
+  // open connections over the budget either.
+  void start_maintenance(steady_clock::duration interval);
+  bool maintaining() const { return _maintaining; }
+  void maintain_soon();
+  // a pool ran dry, only it needs connections
+  void refill_soon(ConnectionPool *);
+  void trim_soon();
+
+  // open connections over all pools, 0 means no limit
+  explicit ConnectionPools(size_t budget = 0) : _budget(budget) {}
+  ~ConnectionPools();
+
+  size_t budget() const { return _budget; }
+  ConnectionStats stats() const;
+  // by osd long id
+  std::map<std::string, CircuitBreaker::State> breaker_states() const;
+  bool over_budget(size_t extra = 0) const {
+    return _budget > 0 &&
+           _counters.idle.load() + _counters.in_use.load() + extra > _budget;
+  }
 
   ConnectionPools(const ConnectionPools &) = delete;
 
   ConnectionPools &operator=(const ConnectionPools &) = delete;
 
 private:
+  friend class ConnectionPool;
+
   mutable std::mutex _mutex;
   std::map<std::string, std::unique_ptr<ConnectionPool>> connection_pools_;
+
+  const size_t _budget;
+  ConnectionCounters _counters;
+  void _trim();
+
+  std::mutex _maintenance_mutex;
+  std::condition_variable _maintenance_cond;
+  std::thread _maintenance_thread;
+  bool _maintenance_requested = false;
+  bool _trim_requested = false;
+  std::set<ConnectionPool *> _refill;
+  bool _stopping = false;
+  std::atomic<bool> _maintaining{false};
 };
 }
 }
@@ -44,14 +44,42 @@ struct asd_exception : std::exception {
   virtual const char *what() const noexcept { return _what.c_str(); }
 };
 
+struct partial_get_request {
+  partial_get_request(string &key, vector<slice> &slices)
+      : key(key), slices(slices), success(false), latency(0) {}
+
+  string &key;
+  vector<slice> &slices;
+  bool success; // false when the key doesn't exist on the asd
+  // from sending the request, or reading the previous response if that
+  // came later, to reading this one. 0 until the response is read
+  std::chrono::steady_clock::duration latency;
+};
+
 class Asd_client : public boost::intrusive::slist_base_hook<> {
 public:
   Asd_client(const std::chrono::steady_clock::duration &,
              std::unique_ptr<transport::Transport> &&,
              boost::optional<string> long_id);
 
-  void partial_get(string &, vector<slice> &);
+  bool partial_get(string &, vector<slice> &);
+
+  /* sends the requests back to back, keeping at most depth of them in
+     flight, and reads the responses in order straight into the slices'
+     targets. the timeout applies to each response separately */
+  void partial_gets(vector<partial_get_request> &, size_t depth);
+
   void set_slowness(asd_protocol::slowness_t &slowness);
+
+  // thread safe: aborts the request in flight, the client is unusable after
+  void cancel();
+
+  // for the requests that follow
+  void set_timeout(const std::chrono::steady_clock::duration &timeout) {
+    _timeout = timeout;
+  }
+  std::chrono::steady_clock::duration timeout() const { return _timeout; }
+
   std::tuple<int32_t, int32_t, int32_t, std::string> get_version();
 
 private:
@@ -59,9 +87,10 @@ private:
 
   asd_protocol::Status _status;
   std::unique_ptr<transport::Transport> _transport;
-  const std::chrono::steady_clock::duration _timeout;
+  std::chrono::steady_clock::duration _timeout;
   llio::message_builder _mb;
   void check_status(const char *function_name);
+  bool read_partial_get_response_(vector<slice> &);
 };
 }
 }
@@ -18,7 +18,10 @@ but WITHOUT ANY WARRANTY of any kind.
 
 #pragma once
 
+#include <cstdint>
 #include <iostream>
+#include <string>
+#include <vector>
 
 namespace alba {
 namespace encryption {
@@ -45,6 +48,13 @@ class NoEncryption : public EncryptInfo {
   virtual bool supports_partial_decrypt() const { return true; }
 };
 
+// a range of a ctr encrypted fragment, decrypted in place
+struct ctr_slice {
+  unsigned char *buf;
+  uint32_t len;
+  uint32_t offset; // in the fragment
+};
+
 enum class algo_t { AES };
 enum class chaining_mode_t { CBC, CTR };
 enum class key_length_t { L256 };
@@ -78,6 +88,21 @@ public:
                                std::string &enc_key, std::string &ctr,
                                int offset) const;
 
+  // slices of the same fragment, with one (per thread cached) cipher
+  // context
+  bool partial_decrypt(const std::vector<ctr_slice> &,
+                       const std::string &enc_key,
+                       const std::string &ctr) const;
+
+  /* decrypts a whole CBC encrypted fragment in place, and strips the
+     padding: len becomes the length of the plain fragment.
+     the iv is derived from the fragment's identity, like alba does;
+     for replication (k = 1) alba uses fragment id 0 for it. */
+  bool cbc_decrypt_fragment(unsigned char *buf, uint32_t &len,
+                            const std::string &enc_key,
+                            const std::string &object_id, uint32_t chunk_id,
+                            uint32_t fragment_id) const;
+
   algo_t algo;
   chaining_mode_t mode;
   key_length_t key_length;
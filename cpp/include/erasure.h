@@ -0,0 +1,72 @@
+/*
+Copyright (C) 2016 iNuron NV
+
+This file is part of Open vStorage Open Source Edition (OSE), as available from
+
+
+    http://www.openvstorage.org and
+    http://www.openvstorage.com.
+
+This file is free software; you can redistribute it and/or modify it
+under the terms of the GNU Affero General Public License v3 (GNU AGPLv3)
+as published by the Free Software Foundation, in version 3 as it comes
+in the <LICENSE.txt> file of the Open vStorage OSE distribution.
+
+Open vStorage is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY of any kind.
+*/
+
+
+#pragma once
+
+#include "alba_common.h"
+
+#include <exception>
+#include <string>
+#include <vector>
+
+namespace alba {
+namespace erasure {
+
+/* Reed-Solomon over GF(2^8) (polynomial 0x11d), compatible with how alba
+   encodes chunks: a systematic (k+m) x k distribution matrix, jerasure's
+   reed_sol_big_vandermonde_distribution_matrix with w=8. Fragment i of a
+   chunk is row i of that matrix times the k data fragments.
+*/
+
+struct erasure_exception : std::exception {
+  erasure_exception(std::string what) : _what(what) {}
+
+  std::string _what;
+
+  virtual const char *what() const noexcept { return _what.c_str(); }
+};
+
+uint8_t gf_mul(uint8_t a, uint8_t b);
+uint8_t gf_div(uint8_t a, uint8_t b);
+
+// row major, (k + m) rows of k columns
+std::vector<uint8_t> distribution_matrix(uint32_t k, uint32_t m);
+
+// n x n, row major, inverted in place. returns false if it is singular
+bool invert_matrix(std::vector<uint8_t> &matrix, uint32_t n);
+
+/* coefficients c such that fragment `wanted` equals
+   sum_j c[j] * fragment[available[j]], for k available fragments */
+std::vector<uint8_t>
+decoding_coefficients(uint32_t k, uint32_t m,
+                      const std::vector<uint32_t> &available, uint32_t wanted);
+
+// target = sum_j coefficients[j] * sources[j]
+void combine(const std::vector<uint8_t> &coefficients,
+             const std::vector<const byte *> &sources, byte *target,
+             size_t len);
+
+void encode(uint32_t k, uint32_t m, const std::vector<const byte *> &data,
+            const std::vector<byte *> &parity, size_t len);
+
+// target ^= c * source, using the widest instruction set available
+void multiply_xor_region(uint8_t c, const byte *source, byte *target,
+                         size_t len);
+}
+}
@@ -69,6 +69,13 @@ public:
                        const consistent_read,
                        std::vector<proxy_protocol::object_info> &,
                        alba::statistics::RoraCounter &);
+  // same, but leaves the manifests serialized
+  virtual void
+  read_objects_slices2(const std::string &namespace_,
+                       const std::vector<proxy_protocol::ObjectSlices> &,
+                       const consistent_read,
+                       std::vector<proxy_protocol::serialized_object_info> &,
+                       alba::statistics::RoraCounter &);
 
   virtual void write_object_fs2(const std::string &namespace_,
                                 const std::string &object_name,
@@ -96,6 +96,11 @@ public:
     return r;
   }
 
+  // an uninitialized buffer, filled through data()
+  static std::shared_ptr<message_buffer> of_size(size_t size) {
+    return std::shared_ptr<message_buffer>(new message_buffer(size));
+  }
+
   char *data(size_t pos) const { return &_data[_start + pos]; }
 
   size_t size() { return _size; }
@@ -74,9 +74,12 @@ typedef std::pair<boost::optional<osd_t>, uint32_t> fragment_location_t;
 
 template <class T> using layout = std::vector<std::vector<T>>;
 
+class CompactManifest;
+
+// a piece of a slice inside one fragment. object id, encryption and
+// counters are looked up in the manifest, to keep this cheap to copy.
 struct Location {
   namespace_t namespace_id;
-  std::string object_id;
   uint32_t chunk_id;
   uint32_t fragment_id;
   uint32_t offset;
@@ -84,8 +87,10 @@ struct Location {
   fragment_location_t fragment_location;
 
   bool uses_compression;
-  std::shared_ptr<EncryptInfo> encrypt_info;
-  boost::optional<std::string> ctr;
+
+  // the manifest this was resolved from, also needed to find the other
+  // fragments of the chunk for reconstruction
+  std::shared_ptr<const CompactManifest> manifest;
 };
 
 struct Fragment {
@@ -126,6 +131,15 @@ struct ManifestWithNamespaceId : Manifest {
   ManifestWithNamespaceId(const ManifestWithNamespaceId &) = delete;
 };
 
+// a manifest as received from the proxy, kept serialized (and compressed)
+// until it's needed. only the namespace id is decoded.
+struct SerializedManifest {
+  namespace_t namespace_id;
+  std::shared_ptr<llio::message_buffer> data;
+
+  std::unique_ptr<ManifestWithNamespaceId> decode() const;
+};
+
 void dump_string(std::ostream &, const std::string &);
 void dump_string_option(std::ostream &, const boost::optional<std::string> &);
 
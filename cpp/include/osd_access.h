@@ -21,10 +21,16 @@ but WITHOUT ANY WARRANTY of any kind.
 #include "asd_access.h"
 #include "osd_info.h"
 #include "proxy_client.h"
+#include "statistics.h"
+#include "worker_pool.h"
 #include <condition_variable>
+#include <deque>
+#include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <set>
+#include <thread>
 #include <vector>
 
 namespace alba {
@@ -37,6 +43,28 @@ struct asd_slice {
   byte *target;
 };
 
+/* everything to read from one fragment with a single partial_get.
+   slices are sorted and don't overlap; overlapping or adjacent ranges are
+   merged, and when their targets aren't contiguous in memory the merged
+   range is read into a scratch buffer and copied out by finish().
+*/
+struct asd_key_read {
+  std::string key;
+  std::vector<asd_protocol::slice> slices;
+
+  struct copy {
+    const byte *from;
+    byte *to;
+    uint32_t len;
+  };
+  std::vector<std::vector<byte>> scratch;
+  std::vector<copy> copies;
+
+  void finish();
+};
+
+std::vector<asd_key_read> plan_key_reads(const std::vector<asd_slice> &);
+
 struct osd_access_exception : std::exception {
   osd_access_exception(uint32_t return_code, std::string what)
       : _return_code(return_code), _what(what) {}
@@ -49,44 +77,178 @@ struct osd_access_exception : std::exception {
 
 using namespace proxy_protocol;
 
+/* osd reads running in the background (see OsdAccess::start_reads).
+   every read belongs to a group, so a hedge can race the reads it
+   replaces.
+*/
+class osd_reads {
+public:
+  osd_reads() : _winner(-1) {}
+
+  // true when all reads of the group finished before the deadline
+  bool wait(int group, std::chrono::steady_clock::time_point deadline);
+
+  // waits until one of the groups succeeded, or both finished.
+  // returns the group that succeeded first, or -1
+  int race(int group_a, int group_b);
+
+  // first failure of the group, in osd order
+  int result(int group);
+
+  std::set<osd_t> pending(int group);
+
+  // keys the asds reported missing, of all groups
+  std::set<std::string> missing();
+
+  // aborts the unfinished reads of the group and waits for them
+  void cancel(int group);
+
+private:
+  friend class OsdAccess;
+
+  struct read {
+    osd_t osd;
+    std::vector<asd_slice> slices;
+    int group;
+    int rc;
+    bool done;
+    bool cancelled;
+    asd_client::Asd_client *connection; // while it's in flight
+  };
+
+  std::mutex _mutex;
+  std::condition_variable _cond;
+  std::deque<read> _reads;
+  int _winner;
+  std::set<std::string> _missing;
+
+  bool _done(int group) const;
+  int _result(int group) const;
+  void _finished(read &, int rc, const std::set<std::string> &missing);
+};
+
+/* what the proxy says about the osds. a snapshot is never changed once
+   it's published, a refresh publishes a new one. */
+struct osd_snapshot {
+  osd_maps_t osd_maps;
+  std::vector<alba_id_t> alba_levels;
+};
+
+typedef std::shared_ptr<const std::vector<alba_id_t>> alba_levels_t;
+
 class OsdAccess {
 public:
+  static OsdAccess &getInstance(const RoraConfig &);
   static OsdAccess &getInstance(int connection_pool_size,
                                 std::chrono::steady_clock::duration timeout);
 
   OsdAccess(OsdAccess const &) = delete;
   void operator=(OsdAccess const &) = delete;
+  ~OsdAccess();
+
   bool osd_is_unknown(osd_t);
+  // known, but disqualified or not an asd
+  bool osd_is_unavailable(osd_t);
 
+  // fetches the osd infos through the client when there are none yet.
+  // otherwise, with a source, a background refresh is requested and this
+  // returns right away.
   bool update(Proxy_client &client);
 
-  int read_osds_slices(std::map<osd_t, std::vector<asd_slice>> &);
+  // where background refreshes get the osd infos. the first one set is
+  // used, every osd_info_refresh_seconds and when update asks for it.
+  void set_osd_info_source(std::function<void(osd_maps_t &)>);
+
+  // -3 when an asd doesn't have a fragment, its key is added to missing
+  int read_osds_slices(std::map<osd_t, std::vector<asd_slice>> &,
+                       std::set<std::string> *missing = nullptr);
+
+  // returns immediately, the reads run on the worker threads
+  void start_reads(std::shared_ptr<osd_reads> &, int group,
+                   std::map<osd_t, std::vector<asd_slice>> &);
 
-  std::vector<alba_id_t> get_alba_levels(Proxy_client &client);
+  // how long to wait for these osds before hedging: the slowest of their
+  // cached latency percentiles. none when hedging is disabled or there
+  // isn't enough latency history yet
+  boost::optional<std::chrono::steady_clock::duration>
+  hedge_delay(const std::map<osd_t, std::vector<asd_slice>> &);
+
+  alba_levels_t get_alba_levels(Proxy_client &client);
+
+  // for callers that want to overlap their own work with osd reads.
+  // separate from the threads doing the reads themselves, which never
+  // block on other tasks.
+  worker_pool::WorkerPool &get_worker_pool() { return _path_pool; }
+
+  asd::ConnectionStats connection_stats() const {
+    return asd_connection_pools.stats();
+  }
+  std::map<std::string, asd::CircuitBreaker::State> breaker_states() const {
+    return asd_connection_pools.breaker_states();
+  }
 
 private:
-  OsdAccess(int connection_pool_size,
-            std::chrono::steady_clock::duration timeout)
-      : _connection_pool_size(connection_pool_size), _timeout(timeout),
-        _filling(false) {}
+  OsdAccess(const RoraConfig &cfg)
+      : _connection_pool_size(cfg.asd_connection_pool_size),
+        _connection_pool_min_size(cfg.asd_connection_pool_min_size),
+        _keepalive(std::chrono::seconds(cfg.asd_keepalive_seconds)),
+        _timeout(std::chrono::milliseconds(
+            cfg.asd_partial_read_timeout_milliseconds)),
+        _pipeline_depth(cfg.asd_pipeline_depth),
+        _hedge_percentile(cfg.asd_hedge_percentile),
+        _hedge_min_delay(
+            std::chrono::microseconds(cfg.asd_hedge_min_delay_microseconds)),
+        _adaptive_timeout(_make_adaptive_timeout(cfg)),
+        _refresh_interval(cfg.osd_info_refresh_seconds),
+        asd_connection_pools(cfg.asd_connection_budget),
+        _path_pool(cfg.asd_read_parallelism),
+        _read_pool(cfg.asd_read_parallelism) {}
 
   int _connection_pool_size;
+  int _connection_pool_min_size;
+  std::chrono::steady_clock::duration _keepalive;
   std::chrono::steady_clock::duration _timeout;
+  int _pipeline_depth;
+  double _hedge_percentile;
+  std::chrono::steady_clock::duration _hedge_min_delay;
+  asd::AdaptiveTimeout _adaptive_timeout;
+  static asd::AdaptiveTimeout _make_adaptive_timeout(const RoraConfig &);
+
+  // only accessed with std::atomic_load and std::atomic_store, readers
+  // never wait for a refresh. TODO should invalidate some things when the
+  // last alba_level changes
+  std::shared_ptr<const osd_snapshot> _snapshot;
+  std::shared_ptr<const osd_snapshot> _current() const {
+    return std::atomic_load(&_snapshot);
+  }
+  // one fetch at a time
+  std::mutex _update_mutex;
+  bool _fetch_(const std::function<void(osd_maps_t &)> &);
 
-  std::mutex _osd_maps_mutex;
-  osd_maps_t _osd_maps;
-  std::vector<alba_id_t> _alba_levels; // TODO should invalidate some things
-                                       // when last alba_level changes
+  std::mutex _refresh_mutex;
+  std::condition_variable _refresh_cond;
+  std::function<void(osd_maps_t &)> _source;
+  std::chrono::seconds _refresh_interval;
+  bool _refresh_requested = false;
+  bool _stopping = false;
+  std::thread _refresh_thread;
+  bool _request_refresh();
 
   std::shared_ptr<info_caps> _find_osd(osd_t);
+  asd::ConnectionPool *_connection_pool(const info_caps &);
+  // starts the thread that opens connections to the asds being read from
+  void _prewarm(const osd_snapshot &);
 
   int _read_osd_slices_asd_direct_path(osd_t osd,
-                                       std::vector<asd_slice> &slices);
+                                       std::vector<asd_slice> &slices,
+                                       std::set<std::string> &missing,
+                                       osd_reads *reads = nullptr,
+                                       osd_reads::read *read = nullptr);
   asd::ConnectionPools asd_connection_pools;
 
-  std::atomic<bool> _filling;
-  std::mutex _filling_mutex;
-  std::condition_variable _filling_cond;
+  // last, so the threads are gone before the rest is destroyed
+  worker_pool::WorkerPool _path_pool;
+  worker_pool::WorkerPool _read_pool;
 };
 
 std::ostream &operator<<(std::ostream &, const asd_slice &);
@@ -45,16 +45,80 @@ struct proxy_exception : std::exception {
 struct RoraConfig {
   RoraConfig(const size_t size = 10000, const bool null_io = false,
              const int asd_connection_pool_size = 5,
-             const int asd_partial_read_timeout_milliseconds = 25)
+             const int asd_partial_read_timeout_milliseconds = 25,
+             const int asd_read_parallelism = 8,
+             const int asd_pipeline_depth = 8)
       : manifest_cache_size(size), use_null_io(null_io),
         asd_connection_pool_size(asd_connection_pool_size),
         asd_partial_read_timeout_milliseconds(
-            asd_partial_read_timeout_milliseconds) {}
+            asd_partial_read_timeout_milliseconds),
+        asd_read_parallelism(asd_read_parallelism),
+        asd_pipeline_depth(asd_pipeline_depth) {}
 
+  // max number of cached manifests, over all namespaces
   size_t manifest_cache_size;
   bool use_null_io;
   int asd_connection_pool_size;
   int asd_partial_read_timeout_milliseconds;
+  // number of threads used to read from different osds concurrently
+  // (0 means read them one after the other)
+  int asd_read_parallelism;
+  // max number of partial_get requests in flight on one asd connection
+  int asd_pipeline_depth;
+
+  // idle connections to each asd read from lately, opened and kept open
+  // by a background thread, which probes them every asd_keepalive_seconds.
+  // reads that find no idle connection fall back instead of connecting.
+  // 0 opens connections only when a read needs one, in the read.
+  int asd_connection_pool_min_size = 1;
+  int asd_keepalive_seconds = 10;
+  // asd connections open over all asds, idle or in use. over it, the
+  // least recently used asds lose their idle ones first. 0 means no limit.
+  size_t asd_connection_budget = 0;
+
+  // the osd infos are refreshed in the background this often,
+  // 0 only refreshes them when an unknown osd shows up
+  int osd_info_refresh_seconds = 60;
+
+  // memory budget of the manifest cache, over all namespaces
+  size_t manifest_cache_bytes = 256 << 20;
+  // keep manifests from the proxy serialized until a read needs them
+  bool lazy_manifest_decoding = false;
+  // the manifest cache is reloaded from this file at startup, and written
+  // to it periodically and by stop_manifest_cache_snapshots. "" disables
+  // this. older snapshots than the max age (in seconds) are ignored.
+  std::string manifest_cache_file = "";
+  int manifest_cache_snapshot_seconds = 60;
+  int manifest_cache_snapshot_max_age = 3600;
+  // consistent reads through a proxy with a local fragment cache use the
+  // fast path too, after checking the cached manifests' object and version
+  // ids against the nsm, through the proxy. that's a read, but one more
+  // nsm round trip per batch.
+  bool validate_consistent_reads = false;
+
+  // when an asd read takes longer than this percentile of recent read
+  // latencies (but at least the minimum delay), the missing data is also
+  // requested from other fragments of the chunk. 0 disables hedging.
+  double asd_hedge_percentile = 0;
+  int asd_hedge_min_delay_microseconds = 500;
+
+  // once an asd has some history, its partial read timeout becomes
+  // multiplier * its p99 latency, within [floor, ceiling].
+  // asd_partial_read_timeout_milliseconds is the timeout until then.
+  // a multiplier of 0 keeps the static timeout.
+  double asd_timeout_p99_multiplier = 3;
+  int asd_timeout_floor_milliseconds = 5;
+  int asd_timeout_ceiling_milliseconds = 250;
+
+  // number of unpacked (decompressed / cbc decrypted) fragments kept
+  // around, 0 disables the cache
+  size_t decompressed_fragment_cache_size = 16;
+
+  // plain fragment ranges kept in memory (bytes), 0 disables the cache.
+  // with a file, ranges evicted from memory are kept there.
+  size_t fragment_cache_bytes = 0;
+  std::string fragment_cache_file = "";
+  size_t fragment_cache_file_bytes = 0;
 
   // RoraConfig &operator=(const RoraConfig &) = delete;
   // RoraConfig(const RoraConfig&) = delete;
@@ -127,6 +191,34 @@ public:
                       const write_barrier write_barrier,
                       const sequences::Sequence &seq);
 
+  /* fetch the manifests of these objects through the proxy, without their
+   * data, so reading them can take the fast path right away. only clients
+   * with a manifest cache do something. returns the number of manifests
+   * fetched, objects that don't exist are skipped. */
+  virtual size_t
+  prefetch_manifests(const std::string & /* namespace_ */,
+                     const std::vector<std::string> & /* object_names */) {
+    return 0;
+  }
+
+  /* same, for all objects list_objects returns for this range */
+  size_t prefetch_manifests(const std::string &namespace_,
+                            const std::string &first, const include_first,
+                            const boost::optional<std::string> &last,
+                            const include_last);
+
+  /* drop cached manifests, so the next read of these objects asks the proxy
+   * again. only clients with a manifest cache do something. */
+  virtual void invalidate_manifest(const std::string & /* namespace_ */,
+                                   const std::string & /* object_name */) {}
+  virtual void
+  invalidate_manifests_with_prefix(const std::string & /* namespace_ */,
+                                   const std::string & /* prefix */) {}
+  /* the manifests of object versions before version_id */
+  virtual void
+  invalidate_manifests_older_than(const std::string & /* namespace_ */,
+                                  uint32_t /* version_id */) {}
+
   /* invalidate_cache influences the result of read requests issued with
    * consistent_read::F. after an invalidate cache request these read
    * requests will be at least consistent up to the point when the
@@ -175,6 +267,11 @@ make_proxy_client(const std::string &ip, const std::string &port,
                   const Transport &transport,
                   const boost::optional<RoraConfig> &rora = boost::none);
 
+/* writes a last snapshot of the manifest cache (see manifest_cache_file)
+   and stops the periodic ones. call it before exiting; nothing is written
+   when the process just ends. */
+void stop_manifest_cache_snapshots();
+
 std::ostream &operator<<(std::ostream &, const RoraConfig &);
 }
 }
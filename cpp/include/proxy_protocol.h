@@ -75,6 +75,9 @@ typedef std::tuple<std::string, alba_id_t,
                    std::unique_ptr<ManifestWithNamespaceId>>
     object_info;
 
+typedef std::tuple<std::string, alba_id_t, std::unique_ptr<SerializedManifest>>
+    serialized_object_info;
+
 using std::string;
 using boost::optional;
 using llio::message_builder;
@@ -157,6 +160,10 @@ void read_read_objects_slices_response(message &m, Status &status,
 void read_read_objects_slices2_response(message &m, Status &status,
                                         const std::vector<ObjectSlices> &dest,
                                         std::vector<object_info> &object_infos);
+// leaves the manifests serialized
+void read_read_objects_slices2_response(
+    message &m, Status &status, const std::vector<ObjectSlices> &dest,
+    std::vector<serialized_object_info> &object_infos);
 
 void write_update_session_request(
     message_builder &mb,
@@ -31,6 +31,7 @@ public:
 
   void write_exact(const char *buf, int len) override;
   void read_exact(char *buf, int len) override;
+  void cancel() override;
 
   RDMA_transport(const std::string &ip, const std::string &port,
                  const std::chrono::steady_clock::duration &timeout);
@@ -19,6 +19,7 @@ but WITHOUT ANY WARRANTY of any kind.
 #pragma once
 #include <chrono>
 #include <iostream>
+#include <mutex>
 #include <vector>
 
 namespace alba {
@@ -29,8 +30,32 @@ using namespace std::chrono;
 struct RoraCounter {
   uint64_t fast_path;
   uint64_t slow_path;
+  uint64_t hedged;     // fast path reads that started a hedge
+  uint64_t hedge_wins; // ... and were served by it
+  uint64_t fragment_cache_hits;
+  uint64_t fragment_cache_misses;
 
-  RoraCounter() : fast_path(0L), slow_path(0L) {}
+  RoraCounter()
+      : fast_path(0L), slow_path(0L), hedged(0L), hedge_wins(0L),
+        fragment_cache_hits(0L), fragment_cache_misses(0L) {}
+};
+
+/* the most recent latencies, for percentile estimates */
+class LatencyWindow {
+public:
+  LatencyWindow(size_t capacity = 1024);
+
+  void add(steady_clock::duration);
+  size_t size() const;
+
+  // p in [0, 100]
+  steady_clock::duration percentile(double p) const;
+
+private:
+  mutable std::mutex _mutex;
+  std::vector<steady_clock::duration> _samples;
+  size_t _capacity;
+  size_t _next;
 };
 
 struct Statistics {
@@ -29,6 +29,7 @@ public:
 
   void write_exact(const char *buf, int len) override;
   void read_exact(char *buf, int len) override;
+  void cancel() override;
 
   void
   expires_from_now(const std::chrono::steady_clock::duration &timeout) override;
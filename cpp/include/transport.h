@@ -48,6 +48,10 @@ public:
   virtual void write_exact(const char *buf, int len) = 0;
   virtual void read_exact(char *buf, int len) = 0;
 
+  // may be called from another thread: aborts the pending (or next)
+  // read/write. the transport can't be used afterwards.
+  virtual void cancel() = 0;
+
   virtual ~Transport(){};
 
   llio::message read_message();
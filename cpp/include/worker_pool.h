@@ -0,0 +1,63 @@
+/*
+Copyright (C) 2016 iNuron NV
+
+This file is part of Open vStorage Open Source Edition (OSE), as available from
+
+
+    http://www.openvstorage.org and
+    http://www.openvstorage.com.
+
+This file is free software; you can redistribute it and/or modify it
+under the terms of the GNU Affero General Public License v3 (GNU AGPLv3)
+as published by the Free Software Foundation, in version 3 as it comes
+in the <LICENSE.txt> file of the Open vStorage OSE distribution.
+
+Open vStorage is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY of any kind.
+*/
+
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace alba {
+namespace worker_pool {
+
+/* a fixed set of threads used to fan out blocking calls.
+   run(tasks) returns when every task has completed; the calling thread
+   takes tasks too, so a batch always makes progress even when all workers
+   are busy with other batches.
+*/
+class WorkerPool {
+public:
+  explicit WorkerPool(size_t n_threads);
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  // rethrows the first exception thrown by one of the tasks
+  void run(std::vector<std::function<void()>> &tasks);
+
+  // fire and forget
+  void submit(std::function<void()> job);
+
+  size_t size() const { return _threads.size(); }
+
+private:
+  std::vector<std::thread> _threads;
+  std::mutex _mutex;
+  std::condition_variable _cond;
+  std::deque<std::function<void()>> _queue;
+  bool _stopping;
+
+  void _work();
+};
+}
+}
@@ -253,6 +253,60 @@ void partial_read_benchmark(const string &host, const string &port,
   }
 }
 
+void fragment_count_benchmark(
+    const string &host, const string &port,
+    const std::chrono::steady_clock::duration &timeout,
+    const alba::transport::Kind &transport, const string &namespace_,
+    const string &file_name, const int n, const RoraConfig &rora_config,
+    const uint32_t fragment_size, const uint32_t max_fragments) {
+
+  ALBA_LOG(WARNING, "fragment_count_benchmark("
+                        << host << ", " << port << ", " << transport
+                        << ", rora_config =" << rora_config << ")");
+
+  using namespace alba::proxy_protocol;
+  using namespace alba::statistics;
+  auto client = make_proxy_client(host, port, timeout, transport, rora_config);
+  std::ostringstream sos;
+  sos << "fragment_count_" << std::rand();
+  string object_name = sos.str();
+  const alba::Checksum *checksum = nullptr;
+  client->write_object_fs(namespace_, object_name, file_name,
+                          allow_overwrite::T, checksum);
+  client->invalidate_cache(namespace_);
+  ALBA_LOG(INFO, "uploaded" << file_name << " as " << object_name);
+
+  for (uint32_t n_fragments = 1; n_fragments <= max_fragments; n_fragments++) {
+    // a slice from the start of the first chunk, spanning n_fragments
+    const uint32_t length = n_fragments * fragment_size;
+    std::vector<alba::byte> buffer(length);
+    SliceDescriptor sd{&buffer[0], 0, length};
+    std::vector<SliceDescriptor> slices{sd};
+    ObjectSlices object_slices{object_name, slices};
+    std::vector<ObjectSlices> objects_slices{object_slices};
+
+    RoraCounter cntr;
+    // warm up the manifest cache
+    client->read_objects_slices(namespace_, objects_slices, consistent_read::F,
+                                cntr);
+    cntr = RoraCounter();
+
+    Statistics stats;
+    for (int i = 0; i < n; i++) {
+      stats.new_start();
+      client->read_objects_slices(namespace_, objects_slices,
+                                  consistent_read::F, cntr);
+      stats.new_stop();
+    }
+    cout << "n_fragments=" << n_fragments << ", length=" << length
+         << std::endl;
+    stats.pretty(cout);
+    cout << "slow_path " << cntr.slow_path << " fast_path " << cntr.fast_path
+         << std::endl;
+    cout << "----------------" << std::endl;
+  }
+}
+
 int main(int argc, const char *argv[]) {
   init_log();
   alba::initialize_libgcrypt();
@@ -273,9 +327,9 @@ int main(int argc, const char *argv[]) {
       " show-object, delete-namespace, create-namespace, "
       " list-namespaces, invalidata-cache, proxy-get-version"
       " proxy-osd_info2"
-      " partial-read-benchmark")("port",
-                                 po::value<string>()->default_value("10000"),
-                                 "the alba proxy port number")(
+      " partial-read-benchmark, fragment-count-benchmark")(
+      "port", po::value<string>()->default_value("10000"),
+      "the alba proxy port number")(
       "host", po::value<string>()->default_value("127.0.0.1"),
       "the alba proxy port hostname")
 
@@ -313,7 +367,14 @@ int main(int argc, const char *argv[]) {
           "if set, all rora partial reads come from the "
           "same object, and hit the same ASD")(
           "asd-pool-size", po::value<uint32_t>()->default_value(5),
-          "config for partial read benchmark");
+          "config for partial read benchmark")(
+          "asd-read-parallelism", po::value<uint32_t>()->default_value(8),
+          "number of osds read concurrently (0 = sequential)")(
+          "fragment-size", po::value<uint32_t>(),
+          "fragment size of the object for fragment count benchmark")(
+          "max-fragments", po::value<uint32_t>()->default_value(8),
+          "largest number of fragments spanned by one read "
+          "(usually k of the preset)");
 
   po::positional_options_description positionalOptions;
   positionalOptions.add("command", 1);
@@ -508,6 +569,20 @@ int main(int argc, const char *argv[]) {
     partial_read_benchmark(host, port, timeout, transport, ns, file, n,
                            n_clients, rora_config, focus, block_size,
                            io_pattern, invalidate_cache);
+  } else if ("fragment-count-benchmark" == command) {
+    string ns = getRequiredStringArg(vm, "namespace");
+    string file = getRequiredStringArg(vm, "file");
+    uint32_t n = getRequiredArg<uint32_t>(vm, "benchmark-size");
+    uint32_t asd_pool_size = getRequiredArg<uint32_t>(vm, "asd-pool-size");
+    uint32_t parallelism = getRequiredArg<uint32_t>(vm, "asd-read-parallelism");
+    uint32_t fragment_size = getRequiredArg<uint32_t>(vm, "fragment-size");
+    uint32_t max_fragments = getRequiredArg<uint32_t>(vm, "max-fragments");
+    RoraConfig rora_config(10000, false, asd_pool_size);
+    rora_config.asd_read_parallelism = parallelism;
+    rora_config.use_null_io = getRequiredArg<bool>(vm, "use-null-io");
+    ALBA_LOG(INFO, "config = " << rora_config);
+    fragment_count_benchmark(host, port, timeout, transport, ns, file, n,
+                             rora_config, fragment_size, max_fragments);
   } else {
     cout << "got invalid command name. valid options are: "
          << "download-object, upload-object, delete-object, list-objects "
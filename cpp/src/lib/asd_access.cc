@@ -19,7 +19,9 @@ but WITHOUT ANY WARRANTY of any kind.
 #include "asd_access.h"
 #include "transport_helper.h"
 
+#include <algorithm>
 #include <iostream>
+#include <stdexcept>
 
 #include <mutex>
 
@@ -30,10 +32,88 @@ using alba::proxy_protocol::OsdInfo;
 
 #define LOCK() std::lock_guard<std::mutex> lock(_mutex)
 
+CircuitBreaker::CircuitBreaker(size_t failure_threshold,
+                               steady_clock::duration backoff,
+                               steady_clock::duration max_backoff)
+    : _threshold(failure_threshold), _min_backoff(backoff),
+      _max_backoff(max_backoff), _backoff(backoff) {}
+
+bool CircuitBreaker::allow(steady_clock::time_point now) {
+  if (_state == State::closed) {
+    return true;
+  }
+  if (now < _until) {
+    return false;
+  }
+  // the first probe, or one that never reported back
+  _state = State::half_open;
+  _until = now + _backoff;
+  return true;
+}
+
+bool CircuitBreaker::would_allow(steady_clock::time_point now) const {
+  return _state == State::closed || now >= _until;
+}
+
+void CircuitBreaker::success() {
+  _failures = 0;
+  _state = State::closed;
+  _backoff = _min_backoff;
+}
+
+void CircuitBreaker::failure(steady_clock::time_point now) {
+  switch (_state) {
+  case State::closed: {
+    if (++_failures >= _threshold) {
+      _open(now);
+    }
+  }; break;
+  case State::half_open: {
+    _backoff = std::min(_max_backoff, 2 * _backoff);
+    _open(now);
+  }; break;
+  case State::open:
+    // reads that were in flight when it tripped
+    break;
+  }
+}
+
+void CircuitBreaker::_open(steady_clock::time_point now) {
+  _state = State::open;
+  _until = now + _backoff;
+  _failures = 0;
+  _trips++;
+}
+
+std::ostream &operator<<(std::ostream &os, const CircuitBreaker::State &s) {
+  switch (s) {
+  case CircuitBreaker::State::closed:
+    os << "closed";
+    break;
+  case CircuitBreaker::State::open:
+    os << "open";
+    break;
+  case CircuitBreaker::State::half_open:
+    os << "half_open";
+    break;
+  }
+  return os;
+}
+
 ConnectionPool::ConnectionPool(std::unique_ptr<OsdInfo> config, size_t capacity,
-                               std::chrono::steady_clock::duration timeout)
-    : config_(std::move(config)), capacity_(capacity), timeout_(timeout),
-      _fast_path_failures(0) {
+                               std::chrono::steady_clock::duration timeout,
+                               const AdaptiveTimeout &adaptive, size_t min_size,
+                               ConnectionPools *owner,
+                               const proxy_protocol::OsdCapabilities &caps,
+                               double hedge_percentile)
+    : config_(std::move(config)), capacity_(capacity), max_capacity_(capacity),
+      min_size_(min_size), owner_(owner),
+      counters_(owner ? owner->_counters : local_counters_),
+      last_used_(steady_clock::now()), timeout_(timeout), adaptive_(adaptive),
+      latencies_(256), samples_(0), adaptive_timeout_(0),
+      hedge_percentile_(hedge_percentile), hedge_latency_(0) {
+  endpoints_ = endpoints(*config_, caps);
+  failed_until_.resize(endpoints_.size());
   ALBA_LOG(INFO, "Created pool for asd client " << *config_ << ", capacity "
                                                 << capacity);
 }
@@ -50,44 +130,285 @@ std::unique_ptr<Asd_client> ConnectionPool::pop_(Connections &conns) {
   return c;
 }
 
+std::unique_ptr<Asd_client> ConnectionPool::pop_back_(Connections &conns) {
+  std::unique_ptr<Asd_client> c;
+  if (not conns.empty()) {
+    auto before = conns.previous(conns.end());
+    c = std::unique_ptr<Asd_client>(&*std::next(before));
+    conns.erase_after(before);
+  }
+
+  return c;
+}
+
+bool ConnectionPool::keep_(std::unique_ptr<Asd_client> conn) {
+  if (connections_.size() >= capacity_) {
+    counters_.closed++;
+    return false;
+  }
+  connections_.push_front(*conn.release());
+  counters_.idle++;
+  return true;
+}
+
 void ConnectionPool::clear_(Connections &conns) {
   while (not conns.empty()) {
     pop_(conns);
   }
 }
 
-std::unique_ptr<Asd_client> ConnectionPool::make_one_() const {
-  alba::transport::Kind t;
-  if (config_->use_rdma) {
-    t = alba::transport::Kind::rdma;
-  } else {
-    t = alba::transport::Kind::tcp;
+std::vector<Endpoint> endpoints(const OsdInfo &info,
+                                const proxy_protocol::OsdCapabilities &caps) {
+  auto kind = [](const std::string &s, alba::transport::Kind dflt) {
+    if (s == "rdma" || s == "RDMA") {
+      return alba::transport::Kind::rdma;
+    } else if (s == "tcp" || s == "TCP") {
+      return alba::transport::Kind::tcp;
+    }
+    return dflt;
+  };
+  auto regular =
+      info.use_rdma ? alba::transport::Kind::rdma : alba::transport::Kind::tcp;
+
+  std::vector<Endpoint> result;
+  if (caps.rora_port != boost::none) {
+    auto rora = regular;
+    if (caps.rora_transport != boost::none) {
+      rora = kind(*caps.rora_transport, regular);
+    }
+    auto &ips = caps.rora_ips != boost::none ? *caps.rora_ips : info.ips;
+    for (auto &ip : ips) {
+      result.push_back(
+          Endpoint{rora, ip, std::to_string(*caps.rora_port), true});
+    }
   }
-  auto transport = alba::transport::make_transport(
-      // TODO try to use other ips too
-      t, config_->ips[0], std::to_string(config_->port), timeout_);
-  std::unique_ptr<Asd_client> c(
-      new Asd_client(timeout_, std::move(transport), config_->long_id));
-  return c;
+  for (auto &ip : info.ips) {
+    result.push_back(
+        Endpoint{regular, ip, std::to_string(info.port), false});
+  }
+  return result;
+}
+
+namespace {
+std::unique_ptr<Asd_client> connect(const Endpoint &e,
+                                    steady_clock::duration timeout,
+                                    const std::string &long_id) {
+  auto transport =
+      alba::transport::make_transport(e.kind, e.ip, e.port, timeout);
+  return std::unique_ptr<Asd_client>(
+      new Asd_client(timeout, std::move(transport), long_id));
+}
+
+// shared by make_one_ and the connects it started, which may outlive it
+struct connect_race {
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::unique_ptr<Asd_client> winner;
+  size_t running = 0;
+  std::vector<size_t> failed;
+  std::exception_ptr error;
+};
+}
+
+std::unique_ptr<Asd_client> ConnectionPool::make_one_() {
+  std::vector<size_t> order;
+  {
+    LOCK();
+    size_t preferred = 0;
+    while (preferred < endpoints_.size() && endpoints_[preferred].rora) {
+      preferred++;
+    }
+    if (preferred == 0) {
+      preferred = endpoints_.size();
+    }
+    if (preferred > 0) {
+      size_t first = next_endpoint_++ % preferred;
+      for (size_t i = 0; i < preferred; i++) {
+        order.push_back((first + i) % preferred);
+      }
+    }
+    for (size_t i = preferred; i < endpoints_.size(); i++) {
+      order.push_back(i);
+    }
+    auto now = steady_clock::now();
+    std::stable_partition(order.begin(), order.end(), [&](size_t i) {
+      return failed_until_[i] <= now;
+    });
+  }
+
+  // the first endpoints race: each one gets a head start of a stagger on
+  // the next, unless it failed sooner. the losers are closed when they
+  // connect.
+  auto race = std::make_shared<connect_race>();
+  size_t raced = std::min<size_t>(order.size(), size_t(race_width));
+  std::vector<size_t> failed;
+  std::exception_ptr error;
+  {
+    std::unique_lock<std::mutex> race_lock(race->mutex);
+    auto done = [&race]() { return race->winner || race->running == 0; };
+    for (size_t n = 0; n < raced && !race->winner; n++) {
+      size_t i = order[n];
+      race->running++;
+      std::thread([race, i, e = endpoints_[i], timeout = timeout_,
+                   long_id = config_->long_id]() {
+        std::unique_ptr<Asd_client> c;
+        std::exception_ptr error;
+        try {
+          c = connect(e, timeout, long_id);
+        } catch (std::exception &ex) {
+          ALBA_LOG(DEBUG, "failed to connect to " << e.ip << ":" << e.port
+                                                  << " `" << ex.what()
+                                                  << "`");
+          error = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(race->mutex);
+        race->running--;
+        if (!c) {
+          race->failed.push_back(i);
+          race->error = error;
+        } else if (!race->winner) {
+          race->winner = std::move(c);
+        }
+        race->cond.notify_all();
+      }).detach();
+      if (n + 1 < raced) {
+        race->cond.wait_for(race_lock, timeout_ / 4, done);
+      }
+    }
+    race->cond.wait(race_lock, done);
+    failed = race->failed;
+    error = race->error;
+  }
+  {
+    LOCK();
+    for (auto i : failed) {
+      failed_until_[i] = steady_clock::now() + seconds(10);
+    }
+  }
+  if (race->winner) {
+    counters_.opened++;
+    return std::move(race->winner);
+  }
+
+  for (size_t n = raced; n < order.size(); n++) {
+    size_t i = order[n];
+    auto &e = endpoints_[i];
+    try {
+      auto c = connect(e, timeout_, config_->long_id);
+      counters_.opened++;
+      return c;
+    } catch (std::exception &ex) {
+      ALBA_LOG(DEBUG, "failed to connect to " << e.ip << ":" << e.port << " `"
+                                              << ex.what() << "`");
+      error = std::current_exception();
+      LOCK();
+      failed_until_[i] = steady_clock::now() + seconds(10);
+    }
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  throw std::runtime_error("no endpoints");
 }
 
 void ConnectionPool::report_failure() {
-  _failure_time = std::chrono::steady_clock::now();
-  _fast_path_failures++;
+  LOCK();
+  report_failure_();
+}
+
+void ConnectionPool::report_failure_() {
+  auto trips = breaker_.trips();
+  breaker_.failure(steady_clock::now());
+  if (breaker_.trips() != trips) {
+    ALBA_LOG(INFO, "circuit breaker of " << *config_ << " is open");
+  }
 }
 
 void ConnectionPool::release_connection(std::unique_ptr<Asd_client> conn) {
-  LOCK();
-  if (conn) {
-    _fast_path_failures = 0;
+  {
+    LOCK();
+    if (not conn) {
+      report_failure_();
+      return;
+    }
+    counters_.in_use--;
+    if (breaker_.state() != CircuitBreaker::State::closed) {
+      ALBA_LOG(INFO, "circuit breaker of " << *config_ << " is closed");
+    }
+    breaker_.success();
     auto current_size = connections_.size();
-    if (current_size < capacity_) {
-      connections_.push_front(*conn.release());
+    if (current_size >= capacity_) {
+      counters_.closed++;
       return;
     }
-  } else {
-    this->report_failure();
+    connections_.push_front(*conn.release());
+    counters_.idle++;
+  }
+  if (owner_ && owner_->over_budget()) {
+    owner_->trim_soon();
+  }
+}
+
+void ConnectionPool::drop_connection(std::unique_ptr<Asd_client> conn) {
+  if (conn) {
+    counters_.in_use--;
+  }
+}
+
+bool ConnectionPool::disqualified_() const {
+  return !breaker_.would_allow(steady_clock::now());
+}
+
+bool ConnectionPool::is_disqualified() const {
+  LOCK();
+  return disqualified_();
+}
+
+CircuitBreaker::State ConnectionPool::breaker_state() const {
+  LOCK();
+  return breaker_.state();
+}
+
+uint64_t ConnectionPool::breaker_trips() const {
+  LOCK();
+  return breaker_.trips();
+}
+
+void ConnectionPool::report_latency(steady_clock::duration latency) {
+  latencies_.add(latency);
+  size_t n = ++samples_;
+  if (n % refresh_samples == 0 || n == adaptive_.min_samples) {
+    refresh_latencies_();
+  }
+}
+
+void ConnectionPool::refresh_latencies_() {
+  size_t size = latencies_.size();
+  if (hedge_percentile_ > 0 && size >= 64) {
+    // 0 means none
+    auto latency = latencies_.percentile(hedge_percentile_);
+    hedge_latency_ = std::max(latency, steady_clock::duration(1)).count();
+  }
+  if (adaptive_.multiplier <= 0 || size < adaptive_.min_samples) {
+    return;
+  }
+  auto p99 = duration_cast<steady_clock::duration>(
+      latencies_.percentile(99) * adaptive_.multiplier);
+  adaptive_timeout_ =
+      std::min(adaptive_.ceiling, std::max(adaptive_.floor, p99)).count();
+}
+
+boost::optional<steady_clock::duration> ConnectionPool::hedge_latency() const {
+  auto latency = hedge_latency_.load();
+  if (latency == 0) {
+    return boost::none;
   }
+  return steady_clock::duration(latency);
+}
+
+steady_clock::duration ConnectionPool::timeout() const {
+  auto adaptive = adaptive_timeout_.load();
+  return adaptive == 0 ? timeout_ : steady_clock::duration(adaptive);
 }
 
 std::unique_ptr<Asd_client> ConnectionPool::get_connection() {
@@ -95,28 +416,182 @@ std::unique_ptr<Asd_client> ConnectionPool::get_connection() {
 
   {
     LOCK();
-    if (_fast_path_failures >= 15) {
-      if (duration_cast<seconds>(steady_clock::now() - _failure_time).count() <
-          120) {
-        return std::unique_ptr<Asd_client>(nullptr);
-      }
+    if (!breaker_.allow(steady_clock::now())) {
+      return std::unique_ptr<Asd_client>(nullptr);
     }
+    gets_++;
+    last_used_ = steady_clock::now();
     conn = pop_(connections_);
+    if (conn) {
+      counters_.idle--;
+    } else if (!probing_) {
+      misses_++;
+      // demand again, before the next maintenance pass notices
+      capacity_ = std::max(capacity_, std::min<size_t>(max_capacity_, 1));
+    }
   }
 
+  if (not conn && owner_ && owner_->maintaining()) {
+    // the pool ran dry: connecting would stall this read, the maintenance
+    // thread connects instead and the read goes elsewhere
+    owner_->refill_soon(this);
+    return conn;
+  }
   if (not conn) {
     try {
       conn = make_one_();
     } catch (std::exception &e) {
-      ALBA_LOG(DEBUG, "failed to connect to " << config_->ips[0] << ":"
-                                              << config_->port << " `"
-                                              << e.what() << "`");
+      ALBA_LOG(DEBUG, "failed to connect to " << *config_ << " `" << e.what()
+                                              << "`");
+      report_failure();
     }
   }
+  if (conn) {
+    counters_.in_use++;
+    conn->set_timeout(timeout());
+  }
 
   return conn;
 }
 
+void ConnectionPool::maintain() {
+  size_t min_size;
+  bool probing;
+  size_t idle;
+  {
+    LOCK();
+    if (!breaker_.allow(steady_clock::now())) {
+      return;
+    }
+    probing = breaker_.state() != CircuitBreaker::State::closed;
+    idle_passes_ = gets_ == 0 && maintained_ ? idle_passes_ + 1 : 0;
+    if (misses_ > 0) {
+      capacity_ = std::min(max_capacity_, capacity_ + 1);
+    } else if (idle_passes_ > 0 && capacity_ > 1) {
+      capacity_--;
+    } else if (idle_passes_ >= idle_passes) {
+      // closes the last idle connection below
+      capacity_ = 0;
+    }
+    // an asd nobody reads from isn't (pre)filled
+    bool in_use = gets_ > 0;
+    // reads that found the pool empty wait for this pass to connect
+    size_t wanted = std::max(min_size_, std::max<size_t>(misses_, 1));
+    min_size = in_use ? std::min(wanted, capacity_) : 0;
+    if (probing) {
+      min_size = std::max<size_t>(min_size, 1);
+    }
+    gets_ = 0;
+    misses_ = 0;
+    maintained_ = true;
+    idle = connections_.size();
+  }
+
+  // reads take connections from the front, so the back has been idle the
+  // longest. the others stay available meanwhile.
+  bool reached = false;
+  for (size_t i = 0; i < idle; i++) {
+    std::unique_ptr<Asd_client> conn;
+    {
+      LOCK();
+      conn = pop_back_(connections_);
+      if (not conn) {
+        break;
+      }
+      counters_.idle--;
+      probing_ = true;
+    }
+    bool alive = true;
+    try {
+      conn->set_timeout(timeout_);
+      conn->get_version();
+    } catch (std::exception &e) {
+      alive = false;
+      counters_.closed++;
+      ALBA_LOG(DEBUG, "dropping connection to " << *config_ << " `"
+                                                << e.what() << "`");
+    }
+    reached = reached || alive;
+    LOCK();
+    probing_ = false;
+    if (alive) {
+      keep_(std::move(conn));
+    }
+  }
+  reached = fill_(min_size) || reached;
+
+  if (probing) {
+    LOCK();
+    if (!reached) {
+      report_failure_();
+    } else {
+      ALBA_LOG(INFO, "circuit breaker of " << *config_ << " is closed");
+      breaker_.success();
+    }
+  }
+}
+
+bool ConnectionPool::fill_(size_t n) {
+  bool reached = false;
+  for (size_t i = 0; i < n; i++) {
+    {
+      LOCK();
+      if (connections_.size() >= n) {
+        break;
+      }
+    }
+    if (owner_ && owner_->over_budget(1)) {
+      break;
+    }
+    std::unique_ptr<Asd_client> conn;
+    try {
+      conn = make_one_();
+    } catch (std::exception &e) {
+      ALBA_LOG(DEBUG, "failed to connect to " << *config_ << " `" << e.what()
+                                              << "`");
+      break;
+    }
+    reached = true;
+    LOCK();
+    if (!keep_(std::move(conn))) {
+      break;
+    }
+  }
+  return reached;
+}
+
+void ConnectionPool::refill() {
+  size_t n;
+  {
+    LOCK();
+    if (disqualified_()) {
+      return;
+    }
+    n = std::min(std::max(min_size_, std::max<size_t>(misses_, 1)),
+                 capacity_);
+  }
+  fill_(n);
+}
+
+steady_clock::time_point ConnectionPool::last_used() const {
+  LOCK();
+  return last_used_;
+}
+
+bool ConnectionPool::close_idle() {
+  std::unique_ptr<Asd_client> conn;
+  {
+    LOCK();
+    conn = pop_(connections_);
+    if (not conn) {
+      return false;
+    }
+    counters_.idle--;
+  }
+  counters_.closed++;
+  return true;
+}
+
 size_t ConnectionPool::size() const {
   LOCK();
   return connections_.size();
@@ -143,6 +618,8 @@ void ConnectionPool::capacity(size_t cap) {
 
       std::swap(tmp, connections_);
     }
+    counters_.idle -= tmp.size();
+    counters_.closed += tmp.size();
   }
 
   clear_(tmp);
@@ -153,7 +630,9 @@ void ConnectionPool::capacity(size_t cap) {
 
 ConnectionPool *ConnectionPools::get_connection_pool(
     const proxy_protocol::OsdInfo &osd_info, int connection_pool_size,
-    std::chrono::steady_clock::duration timeout) {
+    std::chrono::steady_clock::duration timeout,
+    const AdaptiveTimeout &adaptive, size_t min_size,
+    const proxy_protocol::OsdCapabilities &caps, double hedge_percentile) {
   if (!osd_info.kind_asd) {
     return nullptr;
   }
@@ -170,10 +649,152 @@ ConnectionPool *ConnectionPools::get_connection_pool(
         osd_info.long_id,
         std::unique_ptr<ConnectionPool>(new ConnectionPool(
             std::unique_ptr<proxy_protocol::OsdInfo>(osd_info_copy),
-            connection_pool_size, timeout)));
+            connection_pool_size, timeout, adaptive, min_size, this, caps,
+            hedge_percentile)));
     it = connection_pools_.find(osd_info.long_id);
   }
   return it->second.get();
 }
+
+ConnectionPools::~ConnectionPools() {
+  {
+    std::lock_guard<std::mutex> lock(_maintenance_mutex);
+    _stopping = true;
+  }
+  _maintenance_cond.notify_all();
+  if (_maintenance_thread.joinable()) {
+    _maintenance_thread.join();
+  }
+  // while the counters are still there
+  connection_pools_.clear();
+}
+
+ConnectionStats ConnectionPools::stats() const {
+  ConnectionStats result{_counters.idle.load(),
+                         _counters.in_use.load(),
+                         _counters.opened.load(),
+                         _counters.closed.load(),
+                         0,
+                         0,
+                         0};
+  LOCK();
+  for (auto &p : connection_pools_) {
+    auto state = p.second->breaker_state();
+    if (state == CircuitBreaker::State::open) {
+      result.open_breakers++;
+    } else if (state == CircuitBreaker::State::half_open) {
+      result.half_open_breakers++;
+    }
+    result.breaker_trips += p.second->breaker_trips();
+  }
+  return result;
+}
+
+std::map<std::string, CircuitBreaker::State>
+ConnectionPools::breaker_states() const {
+  std::map<std::string, CircuitBreaker::State> result;
+  LOCK();
+  for (auto &p : connection_pools_) {
+    result[p.first] = p.second->breaker_state();
+  }
+  return result;
+}
+
+void ConnectionPools::trim_soon() {
+  std::lock_guard<std::mutex> lock(_maintenance_mutex);
+  _trim_requested = true;
+  _maintenance_cond.notify_all();
+}
+
+void ConnectionPools::_trim() {
+  if (!over_budget()) {
+    return;
+  }
+  std::vector<std::pair<steady_clock::time_point, ConnectionPool *>> pools;
+  {
+    LOCK();
+    for (auto &p : connection_pools_) {
+      pools.emplace_back(p.second->last_used(), p.second.get());
+    }
+  }
+  std::sort(pools.begin(), pools.end(),
+            [](const std::pair<steady_clock::time_point, ConnectionPool *> &a,
+               const std::pair<steady_clock::time_point, ConnectionPool *> &b) {
+              return a.first < b.first;
+            });
+  for (auto &p : pools) {
+    while (over_budget() && p.second->close_idle()) {
+    }
+    if (!over_budget()) {
+      break;
+    }
+  }
+}
+
+void ConnectionPools::maintain_soon() {
+  std::lock_guard<std::mutex> lock(_maintenance_mutex);
+  _maintenance_requested = true;
+  _maintenance_cond.notify_all();
+}
+
+void ConnectionPools::refill_soon(ConnectionPool *pool) {
+  std::lock_guard<std::mutex> lock(_maintenance_mutex);
+  _refill.insert(pool);
+  _maintenance_cond.notify_all();
+}
+
+void ConnectionPools::start_maintenance(steady_clock::duration interval) {
+  std::lock_guard<std::mutex> lock(_maintenance_mutex);
+  if (_maintenance_thread.joinable()) {
+    return;
+  }
+  _maintaining = true;
+  _maintenance_thread = std::thread([this, interval]() {
+    std::unique_lock<std::mutex> lock(_maintenance_mutex);
+    auto wake = [this]() {
+      return _stopping || _maintenance_requested || _trim_requested ||
+             !_refill.empty();
+    };
+    while (!_stopping) {
+      bool woken = true;
+      if (interval > steady_clock::duration::zero()) {
+        woken = _maintenance_cond.wait_for(lock, interval, wake);
+      } else {
+        _maintenance_cond.wait(lock, wake);
+      }
+      if (_stopping) {
+        break;
+      }
+      bool maintain = !woken || _maintenance_requested;
+      _maintenance_requested = false;
+      _trim_requested = false;
+      std::set<ConnectionPool *> refill;
+      std::swap(refill, _refill);
+      lock.unlock();
+      for (auto p : refill) {
+        p->refill();
+      }
+      if (maintain) {
+        // pools are only removed by the destructor
+        std::vector<ConnectionPool *> pools;
+        {
+          LOCK();
+          for (auto &p : connection_pools_) {
+            pools.push_back(p.second.get());
+          }
+        }
+        for (auto p : pools) {
+          p->maintain();
+        }
+        auto s = stats();
+        ALBA_LOG(DEBUG, "asd connections: idle "
+                            << s.idle << ", in use " << s.in_use << ", opened "
+                            << s.opened << ", closed " << s.closed);
+      }
+      _trim();
+      lock.lock();
+    }
+  });
+}
 }
 }
@@ -17,6 +17,7 @@ but WITHOUT ANY WARRANTY of any kind.
 */
 
 #include "asd_client.h"
+#include <algorithm>
 #include <thread>
 
 namespace alba {
@@ -74,25 +75,69 @@ void Asd_client::init_(boost::optional<string> long_id) {
   _transport->expires_from_now(std::chrono::steady_clock::duration::max());
 }
 
-void Asd_client::partial_get(string &key, vector<slice> &slices) {
+bool Asd_client::read_partial_get_response_(vector<slice> &slices) {
+  message response = _transport->read_message();
+  bool success;
+  asd_protocol::read_partial_get_response(response, _status, success);
+
+  check_status(__PRETTY_FUNCTION__);
+
+  if (success) {
+    for (auto &slice : slices) {
+      _transport->read_exact((char *)slice.target, slice.length);
+    }
+  }
+  return success;
+}
+
+bool Asd_client::partial_get(string &key, vector<slice> &slices) {
   _transport->expires_from_now(_timeout);
 
   asd_protocol::write_partial_get_request(_mb, key, slices);
   _transport->output(_mb);
   _mb.reset();
-  message response = _transport->read_message();
-  bool success;
-  asd_protocol::read_partial_get_response(response, _status, success);
+  bool success = read_partial_get_response_(slices);
 
-  check_status(__PRETTY_FUNCTION__);
+  _transport->expires_from_now(std::chrono::steady_clock::duration::max());
+  return success;
+}
 
-  for (auto &slice : slices) {
-    _transport->read_exact((char *)slice.target, slice.length);
+void Asd_client::partial_gets(vector<partial_get_request> &requests,
+                              size_t depth) {
+  depth = std::max(depth, (size_t)1);
+  _transport->expires_from_now(_timeout);
+
+  std::string out;
+  size_t sent = 0;
+  auto t0 = std::chrono::steady_clock::now();
+  for (size_t received = 0; received < requests.size(); received++) {
+    while (sent < requests.size() && sent - received < depth) {
+      auto &r = requests[sent];
+      asd_protocol::write_partial_get_request(_mb, r.key, r.slices);
+      _mb.output_using([&out](const char *buffer, const int len) -> void {
+        out.append(buffer, len);
+      });
+      _mb.reset();
+      sent++;
+    }
+    if (!out.empty()) {
+      _transport->write_exact(out.data(), out.size());
+      out.clear();
+    }
+    auto &r = requests[received];
+    r.success = read_partial_get_response_(r.slices);
+    auto t1 = std::chrono::steady_clock::now();
+    r.latency = t1 - t0;
+    t0 = t1;
+    // the timeout is per response, however long the batch
+    _transport->expires_from_now(_timeout);
   }
 
   _transport->expires_from_now(std::chrono::steady_clock::duration::max());
 }
 
+void Asd_client::cancel() { _transport->cancel(); }
+
 void Asd_client::set_slowness(asd_protocol::slowness_t &slowness) {
   _transport->expires_from_now(_timeout);
   asd_protocol::write_set_slowness_request(_mb, slowness);
@@ -0,0 +1,164 @@
+/*
+  Copyright (C) 2016 iNuron NV
+
+  This file is part of Open vStorage Open Source Edition (OSE), as available
+  from
+
+
+  http://www.openvstorage.org and
+  http://www.openvstorage.com.
+
+  This file is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Affero General Public License v3 (GNU AGPLv3)
+  as published by the Free Software Foundation, in version 3 as it comes
+  in the <LICENSE.txt> file of the Open vStorage OSE distribution.
+
+  Open vStorage is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY of any kind.
+*/
+
+#include "compact_manifest.h"
+#include "stuff.h"
+#include <cstring>
+
+namespace alba {
+namespace proxy_protocol {
+
+using std::string;
+
+string fragment_key(const namespace_t namespace_id, const string &object_id,
+                    uint32_t version_id, uint32_t chunk_id,
+                    uint32_t fragment_id) {
+  llio::message_builder mb;
+  char instance_content_prefix = 'p';
+  mb.add_raw(&instance_content_prefix, 1);
+  uint32_t zero = 0;
+  llio::to(mb, zero);
+  char namespace_char = 'n';
+  mb.add_raw(&namespace_char, 1);
+  alba::to_be(mb, namespace_id);
+  char prefix = 'o';
+  mb.add_raw(&prefix, 1);
+  llio::to(mb, object_id);
+  llio::to(mb, chunk_id);
+  llio::to(mb, fragment_id);
+  llio::to(mb, version_id);
+  return mb.as_string_no_size();
+}
+
+CompactManifest::CompactManifest(const ManifestWithNamespaceId &mf)
+    : name(mf.name), object_id(mf.object_id), namespace_id(mf.namespace_id),
+      chunk_sizes(mf.chunk_sizes), encoding_scheme(mf.encoding_scheme),
+      compressor(mf.compression->get_compressor()),
+      encrypt_info(mf.encrypt_info), size(mf.size),
+      version_id(mf.version_id) {
+  _chunk_offsets.reserve(chunk_sizes.size() + 1);
+  _chunk_offsets.push_back(0);
+  for (auto chunk_size : chunk_sizes) {
+    _chunk_offsets.push_back(_chunk_offsets.back() + chunk_size);
+  }
+
+  _fragment_count = 0;
+  for (auto &chunk : mf.fragments) {
+    _fragment_count = std::max<uint32_t>(_fragment_count, chunk.size());
+  }
+  size_t n = mf.fragments.size() * _fragment_count;
+  _osds.resize(n, osd_t{_no_osd});
+  _versions.resize(n, 0);
+  _lengths.resize(n, 0);
+  _ctrs.resize(n, span{_no_span, 0});
+  _crcs.resize(n, span{_no_span, 0});
+
+  for (uint32_t chunk_id = 0; chunk_id < mf.fragments.size(); chunk_id++) {
+    auto &chunk = mf.fragments[chunk_id];
+    for (uint32_t fragment_id = 0; fragment_id < chunk.size(); fragment_id++) {
+      auto &fragment = *chunk[fragment_id];
+      auto i = _index(chunk_id, fragment_id);
+      if (fragment.loc.first != boost::none) {
+        _osds[i] = *fragment.loc.first;
+      }
+      _versions[i] = fragment.loc.second;
+      _lengths[i] = fragment.len;
+      if (fragment.ctr != boost::none) {
+        _ctrs[i] = _add(*fragment.ctr);
+      }
+      if (fragment.crc != nullptr) {
+        llio::message_builder mb;
+        fragment.crc->to(mb);
+        _crcs[i] = _add(mb.as_string_no_size());
+      }
+    }
+  }
+
+  // all keys of a manifest have the same size
+  _keys = _pool.size();
+  _key_size = 0;
+  for (uint32_t chunk_id = 0; chunk_id < mf.fragments.size(); chunk_id++) {
+    for (uint32_t fragment_id = 0; fragment_id < _fragment_count;
+         fragment_id++) {
+      uint32_t version = _versions[_index(chunk_id, fragment_id)];
+      auto key = proxy_protocol::fragment_key(namespace_id, object_id, version,
+                                              chunk_id, fragment_id);
+      _key_size = key.size();
+      _pool.append(key);
+    }
+  }
+  _pool.shrink_to_fit();
+}
+
+CompactManifest::span CompactManifest::_add(const string &s) {
+  span r{(uint32_t)_pool.size(), (uint32_t)s.size()};
+  _pool.append(s);
+  return r;
+}
+
+boost::optional<string> CompactManifest::ctr(uint32_t chunk_id,
+                                             uint32_t fragment_id) const {
+  auto &s = _ctrs[_index(chunk_id, fragment_id)];
+  if (s.offset == _no_span) {
+    return boost::none;
+  }
+  return _pool.substr(s.offset, s.size);
+}
+
+std::unique_ptr<Checksum> CompactManifest::crc(uint32_t chunk_id,
+                                               uint32_t fragment_id) const {
+  auto &s = _crcs[_index(chunk_id, fragment_id)];
+  if (s.offset == _no_span) {
+    return nullptr;
+  }
+  // as serialized by Checksum::to
+  auto buffer = llio::message_buffer::of_size(s.size);
+  memcpy(buffer->data(0), _pool.data() + s.offset, s.size);
+  llio::message m(buffer);
+  std::unique_ptr<Checksum> result;
+  llio::from(m, result);
+  return result;
+}
+
+size_t CompactManifest::memory_size() const {
+  return sizeof(CompactManifest) + name.capacity() + object_id.capacity() +
+         chunk_sizes.capacity() * sizeof(uint32_t) +
+         _chunk_offsets.capacity() * sizeof(uint64_t) +
+         _osds.capacity() * sizeof(osd_t) +
+         _versions.capacity() * sizeof(uint32_t) +
+         _lengths.capacity() * sizeof(uint32_t) +
+         _ctrs.capacity() * sizeof(span) + _crcs.capacity() * sizeof(span) +
+         _pool.capacity();
+}
+
+std::ostream &operator<<(std::ostream &os, const CompactManifest &mf) {
+  using alba::stuff::operator<<;
+  os << "CompactManifest{name = `";
+  dump_string(os, mf.name);
+  os << "`, object_id = `";
+  dump_string(os, mf.object_id);
+  os << "`, namespace_id = " << mf.namespace_id
+     << ", encoding_scheme = " << mf.encoding_scheme
+     << ", compressor = " << mf.compressor
+     << ", chunk_sizes = " << mf.chunk_sizes << ", size = " << mf.size
+     << ", version_id = " << mf.version_id << "}";
+  return os;
+}
+}
+}
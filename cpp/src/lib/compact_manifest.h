@@ -0,0 +1,123 @@
+/*
+Copyright (C) 2016 iNuron NV
+
+This file is part of Open vStorage Open Source Edition (OSE), as available from
+
+
+    http://www.openvstorage.org and
+    http://www.openvstorage.com.
+
+This file is free software; you can redistribute it and/or modify it
+under the terms of the GNU Affero General Public License v3 (GNU AGPLv3)
+as published by the Free Software Foundation, in version 3 as it comes
+in the <LICENSE.txt> file of the Open vStorage OSE distribution.
+
+Open vStorage is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY of any kind.
+*/
+
+#pragma once
+#include "manifest.h"
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace alba {
+namespace proxy_protocol {
+
+// the asd key of a fragment
+std::string fragment_key(const namespace_t namespace_id,
+                         const std::string &object_id, uint32_t version_id,
+                         uint32_t chunk_id, uint32_t fragment_id);
+
+/* read only, flat copy of a manifest as kept in the manifest cache.
+   per fragment fields are arrays indexed by chunk and fragment id,
+   counters and checksums share one string pool and the asd keys of
+   all fragments are built once, when the copy is made. */
+class CompactManifest {
+public:
+  explicit CompactManifest(const ManifestWithNamespaceId &);
+
+  CompactManifest(const CompactManifest &) = delete;
+  CompactManifest &operator=(const CompactManifest &) = delete;
+
+  std::string name;
+  std::string object_id;
+  namespace_t namespace_id;
+  std::vector<uint32_t> chunk_sizes;
+  EncodingScheme encoding_scheme;
+  compressor_t compressor;
+  std::shared_ptr<EncryptInfo> encrypt_info;
+  uint64_t size;
+  uint32_t version_id;
+
+  uint32_t fragment_count() const { return _fragment_count; }
+
+  // offset of a chunk in the object
+  uint64_t chunk_offset(uint32_t chunk_id) const {
+    return _chunk_offsets[chunk_id];
+  }
+
+  // the chunk holding pos, chunk_sizes.size() if pos is past the end
+  uint32_t chunk_at(uint64_t pos) const {
+    return std::upper_bound(_chunk_offsets.begin(), _chunk_offsets.end(),
+                            pos) -
+           _chunk_offsets.begin() - 1;
+  }
+
+  fragment_location_t location(uint32_t chunk_id, uint32_t fragment_id) const {
+    auto i = _index(chunk_id, fragment_id);
+    if (_osds[i].i == _no_osd) {
+      return fragment_location_t(boost::none, _versions[i]);
+    }
+    return fragment_location_t(_osds[i], _versions[i]);
+  }
+
+  uint32_t fragment_length(uint32_t chunk_id, uint32_t fragment_id) const {
+    return _lengths[_index(chunk_id, fragment_id)];
+  }
+
+  boost::optional<std::string> ctr(uint32_t chunk_id,
+                                   uint32_t fragment_id) const;
+
+  std::unique_ptr<Checksum> crc(uint32_t chunk_id, uint32_t fragment_id) const;
+
+  std::string fragment_key(uint32_t chunk_id, uint32_t fragment_id) const {
+    return _pool.substr(_keys + _index(chunk_id, fragment_id) * _key_size,
+                        _key_size);
+  }
+
+  // rough memory use
+  size_t memory_size() const;
+
+private:
+  static const uint64_t _no_osd = ~0ULL;
+
+  // a string in the pool, absent when offset is _no_span
+  struct span {
+    uint32_t offset;
+    uint32_t size;
+  };
+  static const uint32_t _no_span = ~0U;
+
+  uint32_t _fragment_count;
+  std::vector<uint64_t> _chunk_offsets; // prefix sums of chunk_sizes
+  std::vector<osd_t> _osds;
+  std::vector<uint32_t> _versions;
+  std::vector<uint32_t> _lengths;
+  std::vector<span> _ctrs;
+  std::vector<span> _crcs;
+  std::string _pool;
+  size_t _keys;
+  size_t _key_size;
+
+  size_t _index(uint32_t chunk_id, uint32_t fragment_id) const {
+    return (size_t)chunk_id * _fragment_count + fragment_id;
+  }
+  span _add(const std::string &);
+};
+
+std::ostream &operator<<(std::ostream &, const CompactManifest &);
+}
+}
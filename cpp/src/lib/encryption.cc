@@ -19,7 +19,9 @@ but WITHOUT ANY WARRANTY of any kind.
 #include "encryption.h"
 #include "llio.h"
 
+#include <algorithm>
 #include <gcrypt.h>
+#include <unordered_map>
 
 namespace alba {
 namespace llio {
@@ -110,84 +112,210 @@ template <> void from(message &m, std::shared_ptr<EncryptInfo> &p) {
 namespace alba {
 namespace encryption {
 
+namespace {
+const size_t block_len = 16;
+
+/* cipher handles of this thread, by mode and key.
+   setting the key (the key schedule) is the expensive part of opening
+   one, so handles are kept around instead of opened per decrypt. */
+class cipher_cache {
+public:
+  cipher_cache() = default;
+  cipher_cache(const cipher_cache &) = delete;
+  cipher_cache &operator=(const cipher_cache &) = delete;
+
+  ~cipher_cache() { _clear(); }
+
+  // nullptr on failure
+  gcry_cipher_hd_t get(int algo, int mode, const std::string &enc_key) {
+    std::string id = std::to_string(algo) + "/" + std::to_string(mode) +
+                     "/" + enc_key;
+    auto it = _handles.find(id);
+    if (it != _handles.end()) {
+      return it->second;
+    }
+    if (_handles.size() >= 64) {
+      _clear();
+    }
+    gcry_cipher_hd_t hd;
+    int gcrypt_result = gcry_cipher_open(&hd, algo, mode, 0);
+    if (gcrypt_result != 0) {
+      ALBA_LOG(WARNING, "gcry_cipher_open returned " << gcrypt_result);
+      return nullptr;
+    }
+    gcrypt_result = gcry_cipher_setkey(hd, enc_key.c_str(), enc_key.size());
+    if (gcrypt_result != 0) {
+      ALBA_LOG(WARNING, "gcry_cipher_setkey returned " << gcrypt_result);
+      gcry_cipher_close(hd);
+      return nullptr;
+    }
+    _handles.emplace(id, hd);
+    return hd;
+  }
+
+  // after a failure the handle's state is unknown
+  void drop(gcry_cipher_hd_t hd) {
+    for (auto it = _handles.begin(); it != _handles.end(); ++it) {
+      if (it->second == hd) {
+        gcry_cipher_close(hd);
+        _handles.erase(it);
+        return;
+      }
+    }
+  }
+
+private:
+  void _clear() {
+    for (auto &h : _handles) {
+      gcry_cipher_close(h.second);
+    }
+    _handles.clear();
+  }
+
+  std::unordered_map<std::string, gcry_cipher_hd_t> _handles;
+};
+
+thread_local cipher_cache _cipher_cache;
+
+// ctr + blocks, as a 128 bit big endian number
+void _add_blocks(const std::string &ctr, uint64_t blocks,
+                 unsigned char *result) {
+  uint64_t high = 0;
+  uint64_t low = 0;
+  for (size_t i = 0; i < 8; i++) {
+    high = (high << 8) | (unsigned char)ctr[i];
+    low = (low << 8) | (unsigned char)ctr[i + 8];
+  }
+  uint64_t low2 = low + blocks;
+  if (low2 < low) {
+    high += 1;
+  }
+  for (size_t i = 0; i < 8; i++) {
+    result[7 - i] = (unsigned char)(high >> (8 * i));
+    result[15 - i] = (unsigned char)(low2 >> (8 * i));
+  }
+}
+}
+
 bool Encrypted::partial_decrypt(unsigned char *buf, int len,
                                 std::string &enc_key, std::string &ctr,
                                 int offset) const {
+  std::vector<ctr_slice> slices{
+      ctr_slice{buf, (uint32_t)len, (uint32_t)offset}};
+  return partial_decrypt(slices, enc_key, ctr);
+}
 
+bool Encrypted::partial_decrypt(const std::vector<ctr_slice> &slices,
+                                const std::string &enc_key,
+                                const std::string &ctr) const {
   if (mode != chaining_mode_t::CTR) {
     return false;
   }
 
-  uint64_t block_len = 16;
-
   if (ctr.size() != block_len) {
     assert(false);
   }
 
-  uint64_t skip_blocks = offset / block_len;
-
-  auto ctr_msg = llio::message(llio::message_buffer::from_string(ctr));
-
-  uint64_t high, low;
-  from_be(ctr_msg, high);
-  from_be(ctr_msg, low);
-
-  uint64_t low2 = low + skip_blocks;
-  uint64_t high2 = high;
-  if (std::numeric_limits<uint64_t>::max() - low < skip_blocks) {
-    // low2 overflowed
-    high2 += 1;
+  gcry_cipher_hd_t hd =
+      _cipher_cache.get(GCRY_CIPHER_AES, GCRY_CIPHER_MODE_CTR, enc_key);
+  if (nullptr == hd) {
+    return false;
   }
 
-  llio::message_builder mb;
-  to_be(mb, high2);
-  to_be(mb, low2);
+  for (auto &slice : slices) {
+    unsigned char ctr_with_offset[block_len];
+    _add_blocks(ctr, slice.offset / block_len, ctr_with_offset);
 
-  std::string ctr_with_offset = mb.as_string_no_size();
+    int gcrypt_result = gcry_cipher_setctr(hd, ctr_with_offset, block_len);
+    if (gcrypt_result != 0) {
+      ALBA_LOG(WARNING, "gcry_cipher_setctr returned " << gcrypt_result);
+      _cipher_cache.drop(hd);
+      return false;
+    }
 
-  int gcrypt_result;
+    uint64_t to_burn = slice.offset % block_len;
+    if (to_burn > 0) {
+      char burn_buf[block_len];
+      gcrypt_result = gcry_cipher_decrypt(hd, burn_buf, to_burn, nullptr, 0);
+      if (gcrypt_result != 0) {
+        ALBA_LOG(WARNING, "gcry_cipher_decrypt returned " << gcrypt_result);
+        _cipher_cache.drop(hd);
+        return false;
+      }
+    }
 
-  gcry_cipher_hd_t hd;
-  gcrypt_result =
-      gcry_cipher_open(&hd, GCRY_CIPHER_AES, GCRY_CIPHER_MODE_CTR, 0);
-  if (gcrypt_result != 0) {
-    ALBA_LOG(WARNING, "gcry_cipher_open returned " << gcrypt_result);
-    return false;
+    gcrypt_result = gcry_cipher_decrypt(hd, slice.buf, slice.len, nullptr, 0);
+    if (gcrypt_result != 0) {
+      ALBA_LOG(WARNING, "gcry_cipher_decrypt returned " << gcrypt_result);
+      _cipher_cache.drop(hd);
+      return false;
+    }
   }
+  return true;
+}
 
-  gcrypt_result = gcry_cipher_setkey(hd, enc_key.c_str(), enc_key.size());
-  if (gcrypt_result != 0) {
-    ALBA_LOG(WARNING, "gcry_cipher_setkey returned " << gcrypt_result);
-    gcry_cipher_close(hd);
+bool Encrypted::cbc_decrypt_fragment(unsigned char *buf, uint32_t &len,
+                                     const std::string &enc_key,
+                                     const std::string &object_id,
+                                     uint32_t chunk_id,
+                                     uint32_t fragment_id) const {
+  if (mode != chaining_mode_t::CBC) {
     return false;
   }
-
-  gcrypt_result = gcry_cipher_setctr(hd, ctr_with_offset.c_str(), block_len);
-  if (gcrypt_result != 0) {
-    ALBA_LOG(WARNING, "gcry_cipher_setctr returned " << gcrypt_result);
-    gcry_cipher_close(hd);
+  if (len == 0 || len % block_len != 0) {
+    ALBA_LOG(WARNING, "cbc_decrypt_fragment: bad length " << len);
     return false;
   }
 
-  uint64_t to_burn = offset % block_len;
-  if (to_burn > 0) {
-    char burn_buf[to_burn];
-    gcrypt_result = gcry_cipher_decrypt(hd, burn_buf, to_burn, nullptr, 0);
+  // iv = last block of the cbc encryption (zero iv) of the padded
+  //      serialization of (object_id, chunk_id, fragment_id)
+  llio::message_builder mb;
+  to(mb, object_id);
+  to(mb, chunk_id);
+  to(mb, fragment_id);
+  std::string iv_input = mb.as_string_no_size();
+  size_t pad = block_len - iv_input.size() % block_len;
+  iv_input.append(pad, (char)pad);
+
+  gcry_cipher_hd_t hd =
+      _cipher_cache.get(GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_CBC, enc_key);
+  if (nullptr == hd) {
+    return false;
+  }
+  gcry_cipher_reset(hd);
+  bool ok = false;
+  int gcrypt_result = gcry_cipher_encrypt(hd, &iv_input[0], iv_input.size(),
+                                          nullptr, 0);
+  if (gcrypt_result != 0) {
+    ALBA_LOG(WARNING, "gcry_cipher_encrypt returned " << gcrypt_result);
+  } else {
+    const char *iv = iv_input.data() + iv_input.size() - block_len;
+    gcry_cipher_reset(hd);
+    gcrypt_result = gcry_cipher_setiv(hd, iv, block_len);
     if (gcrypt_result != 0) {
-      ALBA_LOG(WARNING, "gcry_cipher_setctr returned " << gcrypt_result);
-      gcry_cipher_close(hd);
-      return false;
+      ALBA_LOG(WARNING, "gcry_cipher_setiv returned " << gcrypt_result);
+    } else {
+      gcrypt_result = gcry_cipher_decrypt(hd, buf, len, nullptr, 0);
+      if (gcrypt_result != 0) {
+        ALBA_LOG(WARNING, "gcry_cipher_decrypt returned " << gcrypt_result);
+      } else {
+        ok = true;
+      }
     }
   }
-
-  gcrypt_result = gcry_cipher_decrypt(hd, buf, len, nullptr, 0);
-  if (gcrypt_result != 0) {
-    ALBA_LOG(WARNING, "gcry_cipher_setctr returned " << gcrypt_result);
-    gcry_cipher_close(hd);
+  if (!ok) {
+    _cipher_cache.drop(hd);
     return false;
   }
 
-  gcry_cipher_close(hd);
+  uint8_t padding = buf[len - 1];
+  if (padding == 0 || padding > block_len ||
+      !std::all_of(buf + len - padding, buf + len,
+                   [padding](uint8_t b) { return b == padding; })) {
+    ALBA_LOG(WARNING, "cbc_decrypt_fragment: bad padding");
+    return false;
+  }
+  len -= padding;
   return true;
 }
 
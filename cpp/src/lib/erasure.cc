@@ -0,0 +1,347 @@
+/*
+  Copyright (C) 2016 iNuron NV
+
+  This file is part of Open vStorage Open Source Edition (OSE), as available
+  from
+
+
+  http://www.openvstorage.org and
+  http://www.openvstorage.com.
+
+  This file is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Affero General Public License v3 (GNU AGPLv3)
+  as published by the Free Software Foundation, in version 3 as it comes
+  in the <LICENSE.txt> file of the Open vStorage OSE distribution.
+
+  Open vStorage is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY of any kind.
+*/
+
+#include "erasure.h"
+#include "alba_logger.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ALBA_ERASURE_X86 1
+#include <immintrin.h>
+#endif
+
+namespace alba {
+namespace erasure {
+
+namespace {
+struct tables {
+  uint8_t exp[512];
+  uint8_t log[256];
+
+  tables() {
+    uint32_t x = 1;
+    for (int i = 0; i < 255; i++) {
+      exp[i] = x;
+      log[x] = i;
+      x <<= 1;
+      if (x & 0x100) {
+        x ^= 0x11d;
+      }
+    }
+    for (int i = 255; i < 512; i++) {
+      exp[i] = exp[i - 255];
+    }
+    log[0] = 0;
+  }
+};
+
+const tables &_tables() {
+  static tables t;
+  return t;
+}
+}
+
+uint8_t gf_mul(uint8_t a, uint8_t b) {
+  if (a == 0 || b == 0) {
+    return 0;
+  }
+  auto &t = _tables();
+  return t.exp[t.log[a] + t.log[b]];
+}
+
+uint8_t gf_div(uint8_t a, uint8_t b) {
+  if (b == 0) {
+    throw erasure_exception("division by zero");
+  }
+  if (a == 0) {
+    return 0;
+  }
+  auto &t = _tables();
+  return t.exp[t.log[a] + 255 - t.log[b]];
+}
+
+std::vector<uint8_t> distribution_matrix(uint32_t k, uint32_t m) {
+  const uint32_t rows = k + m;
+  const uint32_t cols = k;
+  if (cols == 0 || cols >= rows) {
+    throw erasure_exception("invalid encoding scheme");
+  }
+
+  // extended vandermonde: first row 1 0 .. 0, last row 0 .. 0 1,
+  // row i in between is i^0 i^1 .. i^(cols-1)
+  std::vector<uint8_t> d(rows * cols, 0);
+  d[0] = 1;
+  d[(rows - 1) * cols + cols - 1] = 1;
+  for (uint32_t i = 1; i + 1 < rows; i++) {
+    uint8_t x = 1;
+    for (uint32_t j = 0; j < cols; j++) {
+      d[i * cols + j] = x;
+      x = gf_mul(x, i);
+    }
+  }
+
+  // column operations until the top cols x cols is the identity
+  for (uint32_t i = 1; i < cols; i++) {
+    uint32_t j = i;
+    while (j < rows && d[j * cols + i] == 0) {
+      j++;
+    }
+    if (j >= rows) {
+      throw erasure_exception("could not make distribution matrix");
+    }
+    if (j != i) {
+      for (uint32_t c = 0; c < cols; c++) {
+        std::swap(d[j * cols + c], d[i * cols + c]);
+      }
+    }
+    uint8_t pivot = d[i * cols + i];
+    if (pivot != 1) {
+      uint8_t f = gf_div(1, pivot);
+      for (uint32_t r = 0; r < rows; r++) {
+        d[r * cols + i] = gf_mul(f, d[r * cols + i]);
+      }
+    }
+    for (uint32_t c = 0; c < cols; c++) {
+      uint8_t e = d[i * cols + c];
+      if (c != i && e != 0) {
+        for (uint32_t r = 0; r < rows; r++) {
+          d[r * cols + c] ^= gf_mul(e, d[r * cols + i]);
+        }
+      }
+    }
+  }
+
+  // make row k all ones by scaling the columns of the coding rows
+  for (uint32_t c = 0; c < cols; c++) {
+    uint8_t e = d[cols * cols + c];
+    if (e != 1) {
+      uint8_t f = gf_div(1, e);
+      for (uint32_t r = cols; r < rows; r++) {
+        d[r * cols + c] = gf_mul(f, d[r * cols + c]);
+      }
+    }
+  }
+
+  // and the first column of the other coding rows ones by scaling the rows
+  for (uint32_t r = cols + 1; r < rows; r++) {
+    uint8_t e = d[r * cols];
+    if (e != 1) {
+      uint8_t f = gf_div(1, e);
+      for (uint32_t c = 0; c < cols; c++) {
+        d[r * cols + c] = gf_mul(d[r * cols + c], f);
+      }
+    }
+  }
+  return d;
+}
+
+bool invert_matrix(std::vector<uint8_t> &a, uint32_t n) {
+  std::vector<uint8_t> inv(n * n, 0);
+  for (uint32_t i = 0; i < n; i++) {
+    inv[i * n + i] = 1;
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    uint32_t p = i;
+    while (p < n && a[p * n + i] == 0) {
+      p++;
+    }
+    if (p == n) {
+      return false;
+    }
+    if (p != i) {
+      for (uint32_t c = 0; c < n; c++) {
+        std::swap(a[p * n + c], a[i * n + c]);
+        std::swap(inv[p * n + c], inv[i * n + c]);
+      }
+    }
+    uint8_t f = gf_div(1, a[i * n + i]);
+    for (uint32_t c = 0; c < n; c++) {
+      a[i * n + c] = gf_mul(a[i * n + c], f);
+      inv[i * n + c] = gf_mul(inv[i * n + c], f);
+    }
+    for (uint32_t r = 0; r < n; r++) {
+      uint8_t e = a[r * n + i];
+      if (r != i && e != 0) {
+        for (uint32_t c = 0; c < n; c++) {
+          a[r * n + c] ^= gf_mul(e, a[i * n + c]);
+          inv[r * n + c] ^= gf_mul(e, inv[i * n + c]);
+        }
+      }
+    }
+  }
+  a.swap(inv);
+  return true;
+}
+
+std::vector<uint8_t>
+decoding_coefficients(uint32_t k, uint32_t m,
+                      const std::vector<uint32_t> &available, uint32_t wanted) {
+  if (available.size() != k) {
+    throw erasure_exception("need exactly k fragments to decode");
+  }
+  auto d = distribution_matrix(k, m);
+  std::vector<uint8_t> sub(k * k);
+  for (uint32_t j = 0; j < k; j++) {
+    if (available[j] >= k + m) {
+      throw erasure_exception("fragment id out of range");
+    }
+    std::memcpy(&sub[j * k], &d[available[j] * k], k);
+  }
+  if (!invert_matrix(sub, k)) {
+    throw erasure_exception("fragments are not independent");
+  }
+  // data fragment i is row i of the inverse applied to the available ones,
+  // any other fragment is its distribution row applied to the data ones.
+  std::vector<uint8_t> result(k, 0);
+  for (uint32_t j = 0; j < k; j++) {
+    uint8_t x = 0;
+    for (uint32_t i = 0; i < k; i++) {
+      x ^= gf_mul(d[wanted * k + i], sub[i * k + j]);
+    }
+    result[j] = x;
+  }
+  return result;
+}
+
+namespace {
+
+void _multiply_xor_region_scalar(uint8_t c, const byte *source, byte *target,
+                                 size_t len) {
+  uint8_t row[256];
+  for (int x = 0; x < 256; x++) {
+    row[x] = gf_mul(c, x);
+  }
+  for (size_t i = 0; i < len; i++) {
+    target[i] ^= row[source[i]];
+  }
+}
+
+#ifdef ALBA_ERASURE_X86
+void _nibble_tables(uint8_t c, uint8_t lo[16], uint8_t hi[16]) {
+  for (int x = 0; x < 16; x++) {
+    lo[x] = gf_mul(c, x);
+    hi[x] = gf_mul(c, x << 4);
+  }
+}
+
+__attribute__((target("ssse3"))) void
+_multiply_xor_region_ssse3(uint8_t c, const byte *source, byte *target,
+                           size_t len) {
+  alignas(16) uint8_t lo[16];
+  alignas(16) uint8_t hi[16];
+  _nibble_tables(c, lo, hi);
+  const __m128i tlo = _mm_load_si128((const __m128i *)lo);
+  const __m128i thi = _mm_load_si128((const __m128i *)hi);
+  const __m128i mask = _mm_set1_epi8(0x0f);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i s = _mm_loadu_si128((const __m128i *)(source + i));
+    __m128i l = _mm_shuffle_epi8(tlo, _mm_and_si128(s, mask));
+    __m128i h =
+        _mm_shuffle_epi8(thi, _mm_and_si128(_mm_srli_epi64(s, 4), mask));
+    __m128i t = _mm_loadu_si128((const __m128i *)(target + i));
+    t = _mm_xor_si128(t, _mm_xor_si128(l, h));
+    _mm_storeu_si128((__m128i *)(target + i), t);
+  }
+  if (i < len) {
+    _multiply_xor_region_scalar(c, source + i, target + i, len - i);
+  }
+}
+
+__attribute__((target("avx2"))) void
+_multiply_xor_region_avx2(uint8_t c, const byte *source, byte *target,
+                          size_t len) {
+  alignas(16) uint8_t lo[16];
+  alignas(16) uint8_t hi[16];
+  _nibble_tables(c, lo, hi);
+  const __m256i tlo =
+      _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)lo));
+  const __m256i thi =
+      _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)hi));
+  const __m256i mask = _mm256_set1_epi8(0x0f);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i s = _mm256_loadu_si256((const __m256i *)(source + i));
+    __m256i l = _mm256_shuffle_epi8(tlo, _mm256_and_si256(s, mask));
+    __m256i h = _mm256_shuffle_epi8(
+        thi, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask));
+    __m256i t = _mm256_loadu_si256((const __m256i *)(target + i));
+    t = _mm256_xor_si256(t, _mm256_xor_si256(l, h));
+    _mm256_storeu_si256((__m256i *)(target + i), t);
+  }
+  if (i < len) {
+    _multiply_xor_region_scalar(c, source + i, target + i, len - i);
+  }
+}
+#endif
+
+using region_function = void (*)(uint8_t, const byte *, byte *, size_t);
+
+region_function _select_region_function() {
+#ifdef ALBA_ERASURE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    ALBA_LOG(INFO, "erasure: using avx2");
+    return _multiply_xor_region_avx2;
+  }
+  if (__builtin_cpu_supports("ssse3")) {
+    ALBA_LOG(INFO, "erasure: using ssse3");
+    return _multiply_xor_region_ssse3;
+  }
+#endif
+  return _multiply_xor_region_scalar;
+}
+}
+
+void multiply_xor_region(uint8_t c, const byte *source, byte *target,
+                         size_t len) {
+  static const region_function f = _select_region_function();
+  switch (c) {
+  case 0:
+    break;
+  case 1:
+    for (size_t i = 0; i < len; i++) {
+      target[i] ^= source[i];
+    }
+    break;
+  default:
+    f(c, source, target, len);
+  }
+}
+
+void combine(const std::vector<uint8_t> &coefficients,
+             const std::vector<const byte *> &sources, byte *target,
+             size_t len) {
+  std::memset(target, 0, len);
+  for (size_t j = 0; j < sources.size(); j++) {
+    multiply_xor_region(coefficients[j], sources[j], target, len);
+  }
+}
+
+void encode(uint32_t k, uint32_t m, const std::vector<const byte *> &data,
+            const std::vector<byte *> &parity, size_t len) {
+  auto d = distribution_matrix(k, m);
+  for (uint32_t p = 0; p < m; p++) {
+    std::vector<uint8_t> row(&d[(k + p) * k], &d[(k + p + 1) * k]);
+    combine(row, data, parity[p], len);
+  }
+}
+}
+}
@@ -0,0 +1,219 @@
+/*
+  Copyright (C) 2016 iNuron NV
+
+  This file is part of Open vStorage Open Source Edition (OSE), as available
+  from
+
+
+  http://www.openvstorage.org and
+  http://www.openvstorage.com.
+
+  This file is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Affero General Public License v3 (GNU AGPLv3)
+  as published by the Free Software Foundation, in version 3 as it comes
+  in the <LICENSE.txt> file of the Open vStorage OSE distribution.
+
+  Open vStorage is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY of any kind.
+*/
+
+#include "fragment_cache.h"
+#include "alba_logger.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace alba {
+namespace proxy_client {
+
+FragmentCache &FragmentCache::getInstance(const RoraConfig &cfg) {
+  static FragmentCache instance(cfg.fragment_cache_bytes,
+                                cfg.fragment_cache_file,
+                                cfg.fragment_cache_file_bytes);
+  return instance;
+}
+
+FragmentCache::FragmentCache(size_t capacity, const std::string &file,
+                             size_t file_capacity)
+    : _size(0), _capacity(capacity), _fd(-1), _file_capacity(file_capacity),
+      _file_head(0), _hits(0), _misses(0) {
+  if (capacity > 0 && file != "" && file_capacity > 0) {
+    _fd = ::open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (_fd < 0) {
+      ALBA_LOG(WARNING, "FragmentCache: could not open " << file << ": "
+                                                         << strerror(errno));
+    }
+  }
+  ALBA_LOG(INFO, "FragmentCache(capacity=" << capacity << ", file=" << file
+                                           << ", file_capacity="
+                                           << file_capacity << ")");
+}
+
+FragmentCache::~FragmentCache() {
+  if (_fd >= 0) {
+    ::close(_fd);
+  }
+}
+
+bool FragmentCache::find(const std::string &key, uint32_t offset,
+                         uint32_t len, byte *target) {
+  if (!enabled()) {
+    return false;
+  }
+  bool found;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    found = _find_(key, offset, len, target);
+  }
+  if (!found && _fd >= 0 && _file_find(key, offset, len, target)) {
+    found = true;
+    add(key, offset, len, target);
+  }
+  if (found) {
+    _hits++;
+  } else {
+    _misses++;
+  }
+  return found;
+}
+
+bool FragmentCache::_find_(const std::string &key, uint32_t offset,
+                           uint32_t len, byte *target) {
+  auto it = _index.find(key);
+  if (it == _index.end()) {
+    return false;
+  }
+  for (auto r : it->second) {
+    if (r->offset <= offset && offset + len <= r->offset + r->data.size()) {
+      std::memcpy(target, r->data.data() + (offset - r->offset), len);
+      _lru.splice(_lru.begin(), _lru, r);
+      return true;
+    }
+  }
+  return false;
+}
+
+void FragmentCache::add(const std::string &key, uint32_t offset, uint32_t len,
+                        const byte *data) {
+  if (!enabled() || len > _capacity) {
+    return;
+  }
+  std::vector<range> evicted;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _add_(key, offset, data, len, evicted);
+  }
+  if (_fd >= 0 && !evicted.empty()) {
+    _file_add(evicted);
+  }
+}
+
+void FragmentCache::_add_(const std::string &key, uint32_t offset,
+                          const byte *data, uint32_t len,
+                          std::vector<range> &evicted) {
+  auto &key_ranges = _index[key];
+  for (auto r : key_ranges) {
+    if (r->offset <= offset && offset + len <= r->offset + r->data.size()) {
+      _lru.splice(_lru.begin(), _lru, r);
+      return;
+    }
+  }
+  _lru.push_front(range{key, offset, std::string((const char *)data, len)});
+  key_ranges.push_back(_lru.begin());
+  _size += len;
+
+  while (_size > _capacity) {
+    auto last = std::prev(_lru.end());
+    auto it = _index.find(last->key);
+    auto &v = it->second;
+    v.erase(std::find(v.begin(), v.end(), last));
+    if (v.empty()) {
+      _index.erase(it);
+    }
+    _size -= last->data.size();
+    evicted.push_back(std::move(*last));
+    _lru.erase(last);
+  }
+}
+
+bool FragmentCache::_file_valid_(const file_range &fr) const {
+  return _file_head <= fr.pos + _file_capacity;
+}
+
+bool FragmentCache::_file_find(const std::string &key, uint32_t offset,
+                               uint32_t len, byte *target) {
+  file_range fr;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _file_index.find(key);
+    if (it == _file_index.end()) {
+      return false;
+    }
+    auto &v = it->second;
+    auto found = std::find_if(v.rbegin(), v.rend(), [&](const file_range &f) {
+      return _file_valid_(f) && f.offset <= offset &&
+             offset + len <= f.offset + f.len;
+    });
+    if (found == v.rend()) {
+      return false;
+    }
+    fr = *found;
+  }
+  off_t file_offset = fr.pos % _file_capacity + (offset - fr.offset);
+  ssize_t n = ::pread(_fd, target, len, file_offset);
+  if (n != (ssize_t)len) {
+    return false;
+  }
+  // it may have been overwritten while reading
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _file_valid_(fr);
+}
+
+void FragmentCache::_file_add(std::vector<range> &evicted) {
+  for (auto &r : evicted) {
+    uint32_t len = r.data.size();
+    if (len > _file_capacity) {
+      continue;
+    }
+    uint64_t pos;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      uint64_t wraps = _file_head / _file_capacity;
+      uint64_t physical = _file_head % _file_capacity;
+      if (physical + len > _file_capacity) {
+        _file_head += _file_capacity - physical;
+      }
+      pos = _file_head;
+      _file_head += len;
+
+      if (_file_head / _file_capacity != wraps) {
+        // drop what has been overwritten since the previous wrap
+        for (auto it = _file_index.begin(); it != _file_index.end();) {
+          auto &v = it->second;
+          v.erase(std::remove_if(v.begin(), v.end(),
+                                 [this](const file_range &f) {
+                                   return !_file_valid_(f);
+                                 }),
+                  v.end());
+          if (v.empty()) {
+            it = _file_index.erase(it);
+          } else {
+            ++it;
+          }
+        }
+      }
+    }
+
+    ssize_t n = ::pwrite(_fd, r.data.data(), len, pos % _file_capacity);
+    if (n != (ssize_t)len) {
+      ALBA_LOG(WARNING, "FragmentCache: write failed: " << strerror(errno));
+      continue;
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    _file_index[r.key].push_back(file_range{r.offset, len, pos});
+  }
+}
+}
+}
@@ -0,0 +1,102 @@
+/*
+Copyright (C) 2016 iNuron NV
+
+This file is part of Open vStorage Open Source Edition (OSE), as available from
+
+
+    http://www.openvstorage.org and
+    http://www.openvstorage.com.
+
+This file is free software; you can redistribute it and/or modify it
+under the terms of the GNU Affero General Public License v3 (GNU AGPLv3)
+as published by the Free Software Foundation, in version 3 as it comes
+in the <LICENSE.txt> file of the Open vStorage OSE distribution.
+
+Open vStorage is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY of any kind.
+*/
+
+
+#pragma once
+#include "alba_common.h"
+#include "proxy_client.h"
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace alba {
+namespace proxy_client {
+
+/* plain data of recently read fragment ranges, by fragment key. the key
+   holds the fragment's version, so rewritten objects simply miss.
+   ranges evicted from memory go to an optional file (eg on local nvme),
+   which is used as a ring buffer. */
+class FragmentCache {
+public:
+  // the first config wins
+  static FragmentCache &getInstance(const RoraConfig &);
+
+  FragmentCache(size_t capacity, const std::string &file = "",
+                size_t file_capacity = 0);
+  ~FragmentCache();
+
+  FragmentCache(const FragmentCache &) = delete;
+  FragmentCache &operator=(const FragmentCache &) = delete;
+
+  bool enabled() const { return _capacity > 0; }
+
+  // copies [offset, offset + len) of the fragment to target, if cached
+  bool find(const std::string &key, uint32_t offset, uint32_t len,
+            byte *target);
+
+  void add(const std::string &key, uint32_t offset, uint32_t len,
+           const byte *data);
+
+  uint64_t hits() const { return _hits.load(); }
+  uint64_t misses() const { return _misses.load(); }
+
+private:
+  struct range {
+    std::string key;
+    uint32_t offset;
+    std::string data;
+  };
+  using ranges = std::list<range>;
+
+  std::mutex _mutex;
+  ranges _lru; // most recently used first
+  std::unordered_map<std::string, std::vector<ranges::iterator>> _index;
+  size_t _size;
+  const size_t _capacity;
+
+  bool _find_(const std::string &key, uint32_t offset, uint32_t len,
+              byte *target);
+  void _add_(const std::string &key, uint32_t offset, const byte *data,
+             uint32_t len, std::vector<range> &evicted);
+
+  // second tier. positions are logical: they only grow, the file offset
+  // is position % file capacity. a range is gone once the head moved
+  // more than the file capacity past it.
+  struct file_range {
+    uint32_t offset;
+    uint32_t len;
+    uint64_t pos;
+  };
+  int _fd;
+  const size_t _file_capacity;
+  uint64_t _file_head;
+  std::unordered_map<std::string, std::vector<file_range>> _file_index;
+
+  bool _file_valid_(const file_range &) const;
+  bool _file_find(const std::string &key, uint32_t offset, uint32_t len,
+                  byte *target);
+  void _file_add(std::vector<range> &);
+
+  std::atomic<uint64_t> _hits;
+  std::atomic<uint64_t> _misses;
+};
+}
+}
@@ -256,6 +256,30 @@ void GenericProxy_client::read_objects_slices2(
   check_status(__PRETTY_FUNCTION__);
 }
 
+void GenericProxy_client::read_objects_slices2(
+    const string &namespace_,
+    const vector<proxy_protocol::ObjectSlices> &slices,
+    const consistent_read consistent_read,
+    vector<proxy_protocol::serialized_object_info> &object_infos,
+    alba::statistics::RoraCounter &cntr) {
+
+  if (slices.size() == 0) {
+    return;
+  }
+  _expires_from_now(_timeout);
+
+  proxy_protocol::write_read_objects_slices2_request(
+      _mb, namespace_, slices, BooleanEnumTrue(consistent_read));
+  _output();
+
+  message response = _input();
+  proxy_protocol::read_read_objects_slices2_response(response, _status, slices,
+                                                     object_infos);
+  cntr.slow_path += slices.size();
+
+  check_status(__PRETTY_FUNCTION__);
+}
+
 void GenericProxy_client::write_object_fs2(
     const string &namespace_, const string &object_name,
     const string &input_file, const allow_overwrite allow_overwrite,
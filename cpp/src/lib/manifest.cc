@@ -63,16 +63,33 @@ template <> void from(message &m, std::unique_ptr<Compression> &p) {
   p.reset(r);
 }
 
+// uncompresses into a per thread buffer, which is reused once the
+// previous message on it is gone
+message _uncompress(const char *compressed, size_t size) {
+  size_t real_size;
+  if (!snappy::GetUncompressedLength(compressed, size, &real_size)) {
+    throw deserialisation_exception("corrupt snappy data");
+  }
+  static thread_local std::shared_ptr<message_buffer> buffer;
+  if (buffer == nullptr || buffer.use_count() > 1 ||
+      buffer->size() < real_size) {
+    buffer = message_buffer::of_size(std::max<size_t>(real_size, 4096));
+  }
+  if (!snappy::RawUncompress(compressed, size, buffer->data(0))) {
+    throw deserialisation_exception("corrupt snappy data");
+  }
+  return message(buffer, 0, real_size);
+}
+
 void _from_version1(message &m, Manifest &mf, bool &ok_to_continue) {
   ALBA_LOG(DEBUG, "_from_version1");
-  std::string compressed;
-  from(m, compressed);
+  uint32_t compressed_size;
+  from(m, compressed_size);
+  const char *compressed = m.current(compressed_size);
+  m.skip(compressed_size);
 
-  std::string real;
-  snappy::Uncompress(compressed.data(), compressed.size(), &real);
-  auto buffer = message_buffer::from_string(real);
+  message m2 = _uncompress(compressed, compressed_size);
   ok_to_continue = true;
-  message m2(buffer);
   from(m2, mf.name);
   from(m2, mf.object_id);
 
@@ -213,16 +230,11 @@ void _from_version2(message &m, Manifest &mf, bool &ok_to_continue) {
   ALBA_LOG(DEBUG, "_from_version2");
   uint32_t compressed_size;
   from(m, compressed_size);
-  auto m_compressed = m.get_nested_message(compressed_size);
+  const char *compressed = m.current(compressed_size);
   m.skip(compressed_size);
 
-  std::string real;
-  snappy::Uncompress(m_compressed.current(compressed_size), compressed_size,
-                     &real);
-
-  auto buffer = message_buffer::from_string(real); // TODO:copies
+  message m2 = _uncompress(compressed, compressed_size);
   ok_to_continue = true;
-  message m2(buffer);
   from(m2, mf.name);
   from(m2, mf.object_id);
   from(m2, mf.chunk_sizes);
@@ -260,6 +272,10 @@ void _from_version2(message &m, Manifest &mf, bool &ok_to_continue) {
     };
     mf.fragments[c] = std::move(chunk);
   }
+
+  from(m2, mf.version_id);
+  from(m2, mf.max_disks_per_node);
+  from(m2, mf.timestamp);
 }
 
 template <> void from2(message &m, Manifest &mf, bool &ok_to_continue) {
@@ -300,10 +316,33 @@ template <> void from(message &m, ManifestWithNamespaceId &mfid) {
   bool dont_care = false;
   from2(m, mfid, dont_care);
 }
+
+template <> void from(message &m, SerializedManifest &smf) {
+  // both versions are a version byte followed by a sized, compressed blob
+  const char *start = m.current(5);
+  uint8_t version;
+  from(m, version);
+  uint32_t compressed_size;
+  from(m, compressed_size);
+  m.current(compressed_size);
+  m.skip(compressed_size);
+
+  smf.data = message_buffer::of_size(5 + compressed_size);
+  memcpy(smf.data->data(0), start, 5 + compressed_size);
+  from(m, smf.namespace_id);
+}
 }
 
 namespace proxy_protocol {
 
+std::unique_ptr<ManifestWithNamespaceId> SerializedManifest::decode() const {
+  std::unique_ptr<ManifestWithNamespaceId> mf(new ManifestWithNamespaceId());
+  llio::message m(data);
+  llio::from(m, (Manifest &)*mf);
+  mf->namespace_id = namespace_id;
+  return mf;
+}
+
 std::ostream &operator<<(std::ostream &os, const EncodingScheme &scheme) {
   os << "EncodingScheme{k=" << scheme.k << ", m=" << scheme.m
      << ", w=" << (int)scheme.w << "}";
@@ -17,6 +17,10 @@ but WITHOUT ANY WARRANTY of any kind.
 */
 
 #include "manifest_cache.h"
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <unistd.h>
 
 namespace alba {
 namespace proxy_client {
@@ -28,13 +32,141 @@ ManifestCache &ManifestCache::getInstance() {
   return instance;
 }
 
+ManifestCache::ManifestCache(size_t capacity, size_t byte_capacity,
+                             size_t shards)
+    : _capacity(capacity), _byte_capacity(byte_capacity) {
+  for (size_t i = 0; i < shards; i++) {
+    _shards.emplace_back(new shard);
+  }
+}
+
+ManifestCache::~ManifestCache() {
+  // no last snapshot here: this may run during static destruction, when
+  // the logger can be gone already. see stop_snapshots.
+  _stop_snapshot_thread();
+}
+
+bool ManifestCache::_stop_snapshot_thread() {
+  {
+    std::lock_guard<std::mutex> lock(_snapshot_mutex);
+    _stopping = true;
+  }
+  _snapshot_cv.notify_all();
+  if (!_snapshot_thread.joinable()) {
+    return false;
+  }
+  _snapshot_thread.join();
+  return true;
+}
+
+size_t ManifestCache::stop_snapshots() {
+  if (!_stop_snapshot_thread()) {
+    return 0;
+  }
+  return save(_snapshot_path);
+}
+
 void ManifestCache::set_capacity(size_t capacity) {
-  std::lock_guard<std::mutex> lock(_level1_mutex);
-  _manifest_cache_capacity = capacity;
+  _capacity.store(capacity);
+  for (auto &sp : _shards) {
+    auto &shard = *sp;
+    std::lock_guard<std::shared_timed_mutex> lock(shard.mutex);
+    _evict_(shard);
+  }
+}
+
+void ManifestCache::set_byte_capacity(size_t byte_capacity) {
+  _byte_capacity.store(byte_capacity);
+  for (auto &sp : _shards) {
+    auto &shard = *sp;
+    std::lock_guard<std::shared_timed_mutex> lock(shard.mutex);
+    _evict_(shard);
+  }
+}
+
+size_t ManifestCache::_hash(const string &namespace_, const string &alba_id,
+                            const string &object_name) {
+  std::hash<string> h;
+  size_t result = h(namespace_);
+  result = result * 31 + h(alba_id);
+  result = result * 31 + h(object_name);
+  return result;
+}
+
+bool ManifestCache::_matches(const slot &s, size_t hash,
+                             const string &namespace_, const string &alba_id,
+                             const string &object_name) {
+  return s.hash == hash && s.object_name == object_name &&
+         s.alba_id == alba_id && s.namespace_ == namespace_;
+}
+
+void ManifestCache::_erase_(shard &shard, size_t i) {
+  slot &s = shard.slots[i];
+  auto range = shard.index.equal_range(s.hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (it->second == i) {
+      shard.index.erase(it);
+      break;
+    }
+  }
+  auto ns = shard.namespaces.find(s.namespace_);
+  ns->second.entries--;
+  ns->second.bytes -= s.size;
+  if (ns->second.entries == 0) {
+    shard.namespaces.erase(ns);
+  }
+  shard.entries--;
+  shard.bytes -= s.size;
+  s.mfp = nullptr;
+  s.serialized = nullptr;
+  s.namespace_.clear();
+  s.alba_id.clear();
+  s.object_name.clear();
+  shard.free.push_back(i);
+}
+
+void ManifestCache::_evict_(shard &shard) {
+  size_t capacity = std::max<size_t>(1, _capacity.load() / _shards.size());
+  size_t byte_capacity = _byte_capacity.load() / _shards.size();
+  while (shard.entries > 0 &&
+         (shard.entries > capacity || shard.bytes > byte_capacity)) {
+    // the second pass over a slot always evicts it
+    shard.hand = (shard.hand + 1) % shard.slots.size();
+    slot &s = shard.slots[shard.hand];
+    if (!_used(s)) {
+      continue;
+    }
+    if (s.referenced.exchange(false)) {
+      continue;
+    }
+    _erase_(shard, shard.hand);
+  }
+}
+
+size_t ManifestCache::_find_(shard &shard, size_t hash,
+                             const string &namespace_, const string &alba_id,
+                             const string &object_name) {
+  auto range = shard.index.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (_matches(shard.slots[it->second], hash, namespace_, alba_id,
+                 object_name)) {
+      return it->second;
+    }
+  }
+  return _none;
 }
 
-string make_key(const string alba_id, const string object_name) {
-  return alba_id + object_name;
+size_t ManifestCache::_entry_size(
+    const manifest_cache_entry &mfp,
+    const std::shared_ptr<const SerializedManifest> &serialized) {
+  size_t size = 0;
+  if (mfp != nullptr) {
+    size += manifest_size(*mfp);
+  }
+  if (serialized != nullptr) {
+    size += manifest_size(*serialized);
+  }
+  return size;
 }
 
 void ManifestCache::add(string namespace_, string alba_id,
@@ -42,68 +174,360 @@ void ManifestCache::add(string namespace_, string alba_id,
   ALBA_LOG(DEBUG, "ManifestCache::add namespace=" << namespace_
                                                   << ", alba_id=" << alba_id
                                                   << ", mfp=" << *mfp);
+  string object_name = mfp->name;
+  size_t size = _entry_size(mfp, nullptr);
+  _add(std::move(namespace_), std::move(alba_id), std::move(object_name),
+       std::move(mfp), nullptr, size);
+}
 
-  std::shared_ptr<manifest_cache> mcp = nullptr;
-  std::shared_ptr<std::mutex> mp = nullptr;
-  {
-    std::lock_guard<std::mutex> lock(_level1_mutex);
-    auto it1 = _level1.find(namespace_);
+void ManifestCache::add(string namespace_, string alba_id, string object_name,
+                        std::shared_ptr<const SerializedManifest> serialized,
+                        manifest_cache_entry decoded) {
+  ALBA_LOG(DEBUG, "ManifestCache::add namespace="
+                      << namespace_ << ", alba_id=" << alba_id
+                      << ", object_name=" << object_name << " (serialized)");
+  if (decoded != nullptr && !_keep_serialized.load()) {
+    serialized = nullptr;
+  }
+  size_t size = _entry_size(decoded, serialized);
+  _add(std::move(namespace_), std::move(alba_id), std::move(object_name),
+       std::move(decoded), std::move(serialized), size);
+}
 
-    if (it1 == _level1.end()) {
-      ALBA_LOG(INFO, "ManifestCache::add namespace:'"
-                         << namespace_ << "' : new manifest cache");
-      std::shared_ptr<manifest_cache> mc(
-          new manifest_cache(_manifest_cache_capacity));
-      std::shared_ptr<std::mutex> mm(new std::mutex);
-      auto p = std::make_pair(mc, mm);
-      _level1[namespace_] = std::move(p);
-      it1 = _level1.find(namespace_);
-    } else {
-      ALBA_LOG(DEBUG, "ManifestCache::add namespace:'"
-                          << namespace_ << "' : existing manifest cache");
-    }
-    const auto &v = it1->second;
-    mcp = v.first;
-    mp = v.second;
+void ManifestCache::_add(string namespace_, string alba_id, string object_name,
+                         manifest_cache_entry mfp,
+                         std::shared_ptr<const SerializedManifest> serialized,
+                         size_t size) {
+  size_t hash = _hash(namespace_, alba_id, object_name);
+  size += namespace_.size() + alba_id.size();
+  auto &shard = _shard(hash);
+
+  std::lock_guard<std::shared_timed_mutex> lock(shard.mutex);
+  size_t existing = _find_(shard, hash, namespace_, alba_id, object_name);
+  if (existing != _none) {
+    _erase_(shard, existing);
+  }
+
+  size_t i;
+  if (shard.free.empty()) {
+    i = shard.slots.size();
+    shard.slots.emplace_back();
+  } else {
+    i = shard.free.back();
+    shard.free.pop_back();
   }
+  slot &s = shard.slots[i];
+  s.object_name = std::move(object_name);
+  s.namespace_ = namespace_;
+  s.alba_id = std::move(alba_id);
+  s.hash = hash;
+  s.mfp = std::move(mfp);
+  s.serialized = std::move(serialized);
+  s.size = size;
+  // a new entry gets one pass of the hand before it can go
+  s.referenced.store(true);
+  shard.index.emplace(hash, i);
 
-  manifest_cache &manifest_cache = *mcp;
-  manifest_cache.insert(make_key(alba_id, mfp->name), std::move(mfp));
+  auto &ns = shard.namespaces[namespace_];
+  ns.entries++;
+  ns.bytes += size;
+  shard.entries++;
+  shard.bytes += size;
+  _evict_(shard);
 }
 
 manifest_cache_entry ManifestCache::find(const string &namespace_,
                                          const string &alba_id,
                                          const string &object_name) {
-  std::pair<std::shared_ptr<manifest_cache>, std::shared_ptr<std::mutex>> vp;
+  size_t hash = _hash(namespace_, alba_id, object_name);
+  auto &shard = _shard(hash);
+
+  std::shared_ptr<const SerializedManifest> serialized;
   {
-    std::lock_guard<std::mutex> g(_level1_mutex);
-    auto it = _level1.find(namespace_);
-    if (it == _level1.end()) {
+    std::shared_lock<std::shared_timed_mutex> lock(shard.mutex);
+    size_t i = _find_(shard, hash, namespace_, alba_id, object_name);
+    if (i == _none) {
       return nullptr;
-    } else {
-      vp = it->second;
     }
+    slot &s = shard.slots[i];
+    // only written when not set yet, to keep the cache line shared
+    if (!s.referenced.load(std::memory_order_relaxed)) {
+      s.referenced.store(true, std::memory_order_relaxed);
+    }
+    if (s.mfp != nullptr) {
+      return s.mfp;
+    }
+    serialized = s.serialized;
   }
-  auto &map = *vp.first;
-  auto &mm = *vp.second;
-  {
-    std::lock_guard<std::mutex> g(mm);
-    const auto &maybe_elem = map.find(make_key(alba_id, object_name));
-    if (boost::none == maybe_elem) {
-      return nullptr;
-    } else {
-      return *maybe_elem;
+
+  // decoded without holding the lock, the result replaces the serialized
+  // form unless the entry changed in the mean time. an entry that can't be
+  // decoded is dropped.
+  manifest_cache_entry mfp;
+  try {
+    mfp = std::make_shared<const CompactManifest>(*serialized->decode());
+  } catch (...) {
+    ALBA_LOG(WARNING, "ManifestCache::find could not decode manifest of "
+                          << object_name);
+  }
+  std::lock_guard<std::shared_timed_mutex> lock(shard.mutex);
+  size_t i = _find_(shard, hash, namespace_, alba_id, object_name);
+  if (i == _none || shard.slots[i].serialized != serialized) {
+    return mfp;
+  }
+  if (mfp == nullptr) {
+    _erase_(shard, i);
+  } else {
+    slot &s = shard.slots[i];
+    if (!_keep_serialized.load()) {
+      s.serialized = nullptr;
     }
+    s.mfp = mfp;
+    size_t size =
+        _entry_size(s.mfp, s.serialized) + namespace_.size() + alba_id.size();
+    auto &ns = shard.namespaces[namespace_];
+    ns.bytes = ns.bytes - s.size + size;
+    shard.bytes = shard.bytes - s.size + size;
+    s.size = size;
+    _evict_(shard);
   }
+  return mfp;
 }
 
 void ManifestCache::invalidate_namespace(const string &namespace_) {
   ALBA_LOG(DEBUG, "ManifestCache::invalidate_namespace(" << namespace_ << ")");
-  std::lock_guard<std::mutex> g(_level1_mutex);
-  auto it = _level1.find(namespace_);
-  if (it != _level1.end()) {
-    _level1.erase(it);
+  _invalidate_if(namespace_, [](const slot &) { return true; });
+}
+
+bool ManifestCache::invalidate(const string &namespace_, const string &alba_id,
+                               const string &object_name) {
+  size_t hash = _hash(namespace_, alba_id, object_name);
+  auto &shard = _shard(hash);
+  std::lock_guard<std::shared_timed_mutex> lock(shard.mutex);
+  size_t i = _find_(shard, hash, namespace_, alba_id, object_name);
+  if (i == _none) {
+    return false;
+  }
+  _erase_(shard, i);
+  return true;
+}
+
+size_t ManifestCache::invalidate_prefix(const string &namespace_,
+                                        const string &prefix) {
+  ALBA_LOG(DEBUG, "ManifestCache::invalidate_prefix(" << namespace_ << ", "
+                                                      << prefix << ")");
+  return _invalidate_if(namespace_, [&prefix](const slot &s) {
+    return s.object_name.compare(0, prefix.size(), prefix) == 0;
+  });
+}
+
+size_t ManifestCache::invalidate_older(const string &namespace_,
+                                       uint32_t version_id) {
+  ALBA_LOG(DEBUG, "ManifestCache::invalidate_older(" << namespace_ << ", "
+                                                     << version_id << ")");
+  // serialized entries aren't decoded just to look at their version
+  return _invalidate_if(namespace_, [version_id](const slot &s) {
+    return s.mfp == nullptr || s.mfp->version_id < version_id;
+  });
+}
+
+size_t
+ManifestCache::_invalidate_if(const string &namespace_,
+                              std::function<bool(const slot &)> predicate) {
+  size_t count = 0;
+  for (auto &sp : _shards) {
+    auto &shard = *sp;
+    std::lock_guard<std::shared_timed_mutex> lock(shard.mutex);
+    if (shard.namespaces.count(namespace_) == 0) {
+      continue;
+    }
+    for (size_t i = 0; i < shard.slots.size(); i++) {
+      auto &s = shard.slots[i];
+      if (_used(s) && s.namespace_ == namespace_ && predicate(s)) {
+        _erase_(shard, i);
+        count++;
+      }
+    }
+  }
+  return count;
+}
+
+namespace {
+const string snapshot_magic = "alba manifest cache";
+const uint32_t snapshot_version = 2;
+
+int64_t _seconds_since_epoch() {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+}
+
+void ManifestCache::start_snapshots(const string &path,
+                                    std::chrono::seconds interval,
+                                    const std::vector<string> &alba_ids,
+                                    std::chrono::seconds max_age) {
+  std::lock_guard<std::mutex> lock(_snapshot_mutex);
+  if (_snapshot_path != "") {
+    return;
+  }
+  _snapshot_path = path;
+  _keep_serialized.store(true);
+  load(path, alba_ids, max_age);
+  _snapshot_thread = std::thread([this, path, interval]() {
+    std::unique_lock<std::mutex> lock(_snapshot_mutex);
+    while (!_snapshot_cv.wait_for(lock, interval,
+                                  [this]() { return _stopping; })) {
+      lock.unlock();
+      save(path);
+      lock.lock();
+    }
+  });
+}
+
+size_t ManifestCache::save(const string &path) {
+  struct entry {
+    string namespace_;
+    string alba_id;
+    string object_name;
+    std::shared_ptr<const SerializedManifest> serialized;
+  };
+  std::vector<entry> entries;
+  for (auto &sp : _shards) {
+    auto &shard = *sp;
+    std::shared_lock<std::shared_timed_mutex> lock(shard.mutex);
+    for (auto &s : shard.slots) {
+      if (s.serialized != nullptr) {
+        entries.push_back(
+            entry{s.namespace_, s.alba_id, s.object_name, s.serialized});
+      }
+    }
+  }
+
+  // written next to the old one, which is replaced when complete. the
+  // name is per process, and per process there's one writer at a time.
+  std::lock_guard<std::mutex> lock(_save_mutex);
+  string tmp = path + ".tmp." + std::to_string(getpid());
+  try {
+    std::ofstream os(tmp, std::ios::binary | std::ios::trunc);
+    llio::message_builder mb;
+    llio::to(mb, snapshot_magic);
+    llio::to(mb, snapshot_version);
+    uint64_t saved_at = _seconds_since_epoch();
+    llio::to(mb, saved_at);
+    mb.output(os);
+    for (auto &e : entries) {
+      mb.reset();
+      llio::to(mb, e.namespace_);
+      llio::to(mb, e.alba_id);
+      llio::to(mb, e.object_name);
+      llio::to(mb, e.serialized->namespace_id.i);
+      uint32_t size = e.serialized->data->size();
+      llio::to(mb, size);
+      mb.add_raw(e.serialized->data->data(0), size);
+      mb.output(os);
+    }
+    os.close();
+    if (!os) {
+      throw std::runtime_error("write failed");
+    }
+  } catch (std::exception &e) {
+    ALBA_LOG(WARNING, "ManifestCache::save(" << path << ") failed: "
+                                             << e.what());
+    std::remove(tmp.c_str());
+    return 0;
+  }
+  if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+    ALBA_LOG(WARNING, "ManifestCache::save(" << path << ") rename failed");
+    std::remove(tmp.c_str());
+    return 0;
+  }
+  ALBA_LOG(INFO, "ManifestCache::save(" << path << ") " << entries.size()
+                                        << " entries");
+  return entries.size();
+}
+
+size_t ManifestCache::load(const string &path,
+                           const std::vector<string> &alba_ids,
+                           std::chrono::seconds max_age) {
+  std::ifstream is(path, std::ios::binary);
+  if (!is.good()) {
+    return 0;
+  }
+  size_t n = 0;
+  try {
+    llio::message header(llio::message_buffer::from_istream(is));
+    string magic;
+    uint32_t version;
+    llio::from(header, magic);
+    llio::from(header, version);
+    if (magic != snapshot_magic || version != snapshot_version) {
+      ALBA_LOG(WARNING, "ManifestCache::load(" << path
+                                               << ") unknown file format");
+      return 0;
+    }
+    uint64_t saved_at;
+    llio::from(header, saved_at);
+    auto age = std::chrono::seconds(_seconds_since_epoch() -
+                                    static_cast<int64_t>(saved_at));
+    if (age > max_age) {
+      ALBA_LOG(INFO, "ManifestCache::load(" << path << ") snapshot is "
+                                            << age.count()
+                                            << "s old, not loading it");
+      return 0;
+    }
+    while (is.peek() != EOF) {
+      llio::message m(llio::message_buffer::from_istream(is));
+      string namespace_, alba_id, object_name;
+      llio::from(m, namespace_);
+      llio::from(m, alba_id);
+      llio::from(m, object_name);
+      auto serialized = std::make_shared<SerializedManifest>();
+      llio::from(m, serialized->namespace_id.i);
+      uint32_t size;
+      llio::from(m, size);
+      serialized->data = llio::message_buffer::of_size(size);
+      memcpy(serialized->data->data(0), m.current(size), size);
+      // entries of an alba that's no longer ours are never valid
+      if (std::find(alba_ids.begin(), alba_ids.end(), alba_id) ==
+          alba_ids.end()) {
+        continue;
+      }
+      add(std::move(namespace_), std::move(alba_id), std::move(object_name),
+          std::move(serialized));
+      n++;
+    }
+  } catch (std::exception &e) {
+    ALBA_LOG(WARNING, "ManifestCache::load(" << path << ") stopped after " << n
+                                             << " entries: " << e.what());
+  }
+  ALBA_LOG(INFO, "ManifestCache::load(" << path << ") " << n << " entries");
+  return n;
+}
+
+std::map<string, ManifestCache::occupancy> ManifestCache::get_occupancy() {
+  std::map<string, occupancy> result;
+  for (auto &sp : _shards) {
+    auto &shard = *sp;
+    std::shared_lock<std::shared_timed_mutex> lock(shard.mutex);
+    for (auto &ns : shard.namespaces) {
+      auto &o = result[ns.first];
+      o.entries += ns.second.entries;
+      o.bytes += ns.second.bytes;
+    }
+  }
+  return result;
+}
+
+ManifestCache::occupancy ManifestCache::total() {
+  occupancy result{0, 0};
+  for (auto &sp : _shards) {
+    auto &shard = *sp;
+    std::shared_lock<std::shared_timed_mutex> lock(shard.mutex);
+    result.entries += shard.entries;
+    result.bytes += shard.bytes;
   }
+  return result;
 }
 }
 }
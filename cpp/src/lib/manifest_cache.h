@@ -17,43 +17,158 @@ but WITHOUT ANY WARRANTY of any kind.
 */
 
 #pragma once
-#include "lru_cache.h"
-#include "manifest.h"
+#include "compact_manifest.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 namespace alba {
 namespace proxy_client {
 
 using namespace proxy_protocol;
-typedef std::shared_ptr<ManifestWithNamespaceId> manifest_cache_entry;
-typedef ovs::SafeLRUCache<std::string, manifest_cache_entry> manifest_cache;
+typedef std::shared_ptr<const CompactManifest> manifest_cache_entry;
+
+// rough memory use of a cached manifest
+inline size_t manifest_size(const CompactManifest &mf) {
+  return mf.memory_size();
+}
+inline size_t manifest_size(const SerializedManifest &mf) {
+  return sizeof(SerializedManifest) + sizeof(llio::message_buffer) +
+         mf.data->size();
+}
+
+/* manifests of all namespaces, limited in entries and in bytes.
+   the cache is split in shards by key hash; a lookup takes its shard's
+   lock shared and only sets a reference bit, eviction is CLOCK.
+   manifests can be added serialized, the first find decodes them.
+   with snapshots the serialized form is kept, to be written to a file. */
 class ManifestCache {
 public:
   static ManifestCache &getInstance();
+
+  ManifestCache(size_t capacity = 10000, size_t byte_capacity = 256 << 20,
+                size_t shards = 16);
+  ~ManifestCache();
+
   void set_capacity(size_t capacity);
+  void set_byte_capacity(size_t byte_capacity);
 
   ManifestCache(ManifestCache const &) = delete;
   void operator=(ManifestCache const &) = delete;
 
   void add(std::string namespace_, std::string alba_id,
            manifest_cache_entry rora_map);
+  void add(std::string namespace_, std::string alba_id,
+           std::string object_name,
+           std::shared_ptr<const SerializedManifest> serialized,
+           manifest_cache_entry decoded = nullptr);
 
   manifest_cache_entry find(const std::string &namespace_,
                             const std::string &alba_id,
                             const std::string &object_name);
 
   void invalidate_namespace(const std::string &);
+  // true if the entry was there
+  bool invalidate(const std::string &namespace_, const std::string &alba_id,
+                  const std::string &object_name);
+  // these return the number of entries dropped, of all alba ids
+  size_t invalidate_prefix(const std::string &namespace_,
+                           const std::string &prefix);
+  // entries with a version_id below the given one
+  size_t invalidate_older(const std::string &namespace_, uint32_t version_id);
+
+  // loads the file once (entries of other alba ids are skipped), then
+  // writes it every interval
+  void start_snapshots(const std::string &path, std::chrono::seconds interval,
+                       const std::vector<std::string> &alba_ids,
+                       std::chrono::seconds max_age = std::chrono::hours(1));
+  // ends the periodic snapshots with a last one, returns its entries
+  size_t stop_snapshots();
+  // both return the number of entries. a snapshot written longer than
+  // max_age ago isn't loaded
+  size_t save(const std::string &path);
+  size_t load(const std::string &path,
+              const std::vector<std::string> &alba_ids,
+              std::chrono::seconds max_age = std::chrono::hours(1));
+
+  struct occupancy {
+    size_t entries;
+    size_t bytes;
+  };
+  std::map<std::string, occupancy> get_occupancy();
+  occupancy total();
 
 private:
-  ManifestCache() {}
-  size_t _manifest_cache_capacity = 10000;
-  std::mutex _level1_mutex;
-  std::map<std::string, std::pair<std::shared_ptr<manifest_cache>,
-                                  std::shared_ptr<std::mutex>>>
-      _level1;
+  struct slot {
+    std::string namespace_;
+    std::string alba_id;
+    std::string object_name;
+    size_t hash = 0;
+    manifest_cache_entry mfp;
+    std::shared_ptr<const SerializedManifest> serialized;
+    size_t size = 0;
+    std::atomic<bool> referenced{false};
+  };
+
+  struct shard {
+    std::shared_timed_mutex mutex;
+    std::deque<slot> slots; // slots without a manifest are free
+    std::vector<size_t> free;
+    std::unordered_multimap<size_t, size_t> index; // hash -> slot
+    size_t hand = 0;
+    size_t entries = 0;
+    size_t bytes = 0;
+    std::unordered_map<std::string, occupancy> namespaces;
+  };
+
+  std::vector<std::unique_ptr<shard>> _shards;
+  std::atomic<size_t> _capacity;
+  std::atomic<size_t> _byte_capacity;
+  std::atomic<bool> _keep_serialized{false};
+
+  std::mutex _snapshot_mutex;
+  std::condition_variable _snapshot_cv;
+  std::thread _snapshot_thread;
+  std::string _snapshot_path;
+  bool _stopping = false;
+  // one writer at a time for the temporary file
+  std::mutex _save_mutex;
+  // false if there was no snapshot thread (anymore)
+  bool _stop_snapshot_thread();
+
+  shard &_shard(size_t hash) { return *_shards[hash % _shards.size()]; }
+  static size_t _hash(const std::string &namespace_,
+                      const std::string &alba_id,
+                      const std::string &object_name);
+  static bool _matches(const slot &, size_t hash,
+                       const std::string &namespace_,
+                       const std::string &alba_id,
+                       const std::string &object_name);
+  static bool _used(const slot &s) {
+    return s.mfp != nullptr || s.serialized != nullptr;
+  }
+  static const size_t _none = ~(size_t)0;
+  size_t _find_(shard &, size_t hash, const std::string &namespace_,
+                const std::string &alba_id, const std::string &object_name);
+  size_t _entry_size(const manifest_cache_entry &,
+                     const std::shared_ptr<const SerializedManifest> &);
+  void _add(std::string namespace_, std::string alba_id,
+            std::string object_name, manifest_cache_entry mfp,
+            std::shared_ptr<const SerializedManifest> serialized, size_t size);
+  void _erase_(shard &, size_t i);
+  size_t _invalidate_if(const std::string &namespace_,
+                        std::function<bool(const slot &)> predicate);
+  void _evict_(shard &);
 };
 }
 }
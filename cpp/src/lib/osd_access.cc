@@ -20,29 +20,225 @@
 #include "alba_logger.h"
 
 #include "stuff.h"
+#include <algorithm>
 #include <assert.h>
+#include <cstring>
+#include <unordered_map>
 
 namespace alba {
 namespace proxy_client {
 
+void asd_key_read::finish() {
+  for (auto &c : copies) {
+    std::memcpy(c.to, c.from, c.len);
+  }
+}
+
+namespace {
+void _add_range(asd_key_read &kr, std::vector<const asd_slice *> &group,
+                uint32_t start, uint32_t end) {
+  const asd_slice &first = *group[0];
+  bool direct = std::all_of(group.begin(), group.end(),
+                            [&first](const asd_slice *s) {
+                              return s->target ==
+                                     first.target + (s->offset - first.offset);
+                            });
+  if (direct) {
+    kr.slices.push_back(asd_protocol::slice{start, end - start, first.target});
+  } else {
+    kr.scratch.emplace_back(end - start);
+    byte *buf = kr.scratch.back().data();
+    kr.slices.push_back(asd_protocol::slice{start, end - start, buf});
+    for (auto s : group) {
+      kr.copies.push_back(
+          asd_key_read::copy{buf + (s->offset - start), s->target, s->len});
+    }
+  }
+}
+}
+
+std::vector<asd_key_read> plan_key_reads(const std::vector<asd_slice> &slices) {
+  std::vector<std::vector<const asd_slice *>> per_key;
+  std::unordered_map<std::string, size_t> index;
+  for (auto &s : slices) {
+    auto it = index.find(s.key);
+    if (it == index.end()) {
+      index.emplace(s.key, per_key.size());
+      per_key.push_back({&s});
+    } else {
+      per_key[it->second].push_back(&s);
+    }
+  }
+
+  std::vector<asd_key_read> result;
+  result.reserve(per_key.size());
+  for (auto &key_slices : per_key) {
+    std::sort(key_slices.begin(), key_slices.end(),
+              [](const asd_slice *a, const asd_slice *b) {
+                return a->offset < b->offset;
+              });
+    result.emplace_back();
+    asd_key_read &kr = result.back();
+    kr.key = key_slices[0]->key;
+
+    std::vector<const asd_slice *> group;
+    uint32_t start = 0;
+    uint32_t end = 0;
+    for (auto s : key_slices) {
+      if (!group.empty() && s->offset > end) {
+        _add_range(kr, group, start, end);
+        group.clear();
+      }
+      if (group.empty()) {
+        start = s->offset;
+        end = s->offset + s->len;
+      } else {
+        end = std::max(end, s->offset + s->len);
+      }
+      group.push_back(s);
+    }
+    _add_range(kr, group, start, end);
+  }
+  return result;
+}
+
+bool osd_reads::_done(int group) const {
+  return std::all_of(_reads.begin(), _reads.end(), [group](const read &r) {
+    return r.group != group || r.done;
+  });
+}
+
+int osd_reads::_result(int group) const {
+  for (auto &r : _reads) {
+    if (r.group == group && r.rc) {
+      return r.rc;
+    }
+  }
+  return 0;
+}
+
+void osd_reads::_finished(read &r, int rc,
+                          const std::set<std::string> &missing) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _missing.insert(missing.begin(), missing.end());
+  r.rc = rc;
+  r.done = true;
+  r.connection = nullptr;
+  if (_winner < 0 && _done(r.group) && _result(r.group) == 0) {
+    _winner = r.group;
+  }
+  _cond.notify_all();
+}
+
+bool osd_reads::wait(int group,
+                     std::chrono::steady_clock::time_point deadline) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return _cond.wait_until(lock, deadline,
+                          [this, group]() { return _done(group); });
+}
+
+int osd_reads::race(int group_a, int group_b) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _cond.wait(lock, [this, group_a, group_b]() {
+    return _winner == group_a || _winner == group_b ||
+           (_done(group_a) && _done(group_b));
+  });
+  return (_winner == group_a || _winner == group_b) ? _winner : -1;
+}
+
+int osd_reads::result(int group) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _result(group);
+}
+
+std::set<osd_t> osd_reads::pending(int group) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  std::set<osd_t> result;
+  for (auto &r : _reads) {
+    if (r.group == group && !r.done) {
+      result.insert(r.osd);
+    }
+  }
+  return result;
+}
+
+std::set<std::string> osd_reads::missing() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _missing;
+}
+
+void osd_reads::cancel(int group) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  for (auto &r : _reads) {
+    if (r.group == group && !r.done) {
+      r.cancelled = true;
+      if (r.connection) {
+        r.connection->cancel();
+      }
+    }
+  }
+  _cond.wait(lock, [this, group]() { return _done(group); });
+}
+
+OsdAccess &OsdAccess::getInstance(const RoraConfig &cfg) {
+  static OsdAccess instance(cfg);
+  return instance;
+}
+
 OsdAccess &OsdAccess::getInstance(int connection_pool_size,
                                   std::chrono::steady_clock::duration timeout) {
-  static OsdAccess instance(connection_pool_size, timeout);
-  return instance;
+  RoraConfig cfg;
+  cfg.asd_connection_pool_size = connection_pool_size;
+  cfg.asd_partial_read_timeout_milliseconds =
+      std::chrono::duration_cast<std::chrono::milliseconds>(timeout).count();
+  return getInstance(cfg);
+}
+
+asd::AdaptiveTimeout OsdAccess::_make_adaptive_timeout(const RoraConfig &cfg) {
+  asd::AdaptiveTimeout adaptive;
+  adaptive.multiplier = cfg.asd_timeout_p99_multiplier;
+  adaptive.floor =
+      std::chrono::milliseconds(cfg.asd_timeout_floor_milliseconds);
+  adaptive.ceiling =
+      std::chrono::milliseconds(cfg.asd_timeout_ceiling_milliseconds);
+  return adaptive;
+}
+
+OsdAccess::~OsdAccess() {
+  {
+    std::lock_guard<std::mutex> lock(_refresh_mutex);
+    _stopping = true;
+  }
+  _refresh_cond.notify_all();
+  if (_refresh_thread.joinable()) {
+    _refresh_thread.join();
+  }
 }
 
 bool OsdAccess::osd_is_unknown(osd_t osd) {
-  std::lock_guard<std::mutex> lock(_osd_maps_mutex);
-  auto &pair = _osd_maps[_osd_maps.size() - 1];
-  auto &map = pair.second;
-  bool result = (map.find(osd) == map.end());
-  return result;
+  auto snapshot = _current();
+  if (nullptr == snapshot || snapshot->osd_maps.empty()) {
+    return true;
+  }
+  auto &map = snapshot->osd_maps.back().second;
+  return map.find(osd) == map.end();
+}
+
+bool OsdAccess::osd_is_unavailable(osd_t osd) {
+  auto maybe_ic = _find_osd(osd);
+  if (nullptr == maybe_ic) {
+    return false;
+  }
+  auto p = _connection_pool(*maybe_ic);
+  return nullptr == p || p->is_disqualified();
 }
 
 std::shared_ptr<info_caps> OsdAccess::_find_osd(osd_t osd) {
-  std::lock_guard<std::mutex> lock(_osd_maps_mutex);
-  auto &pair = _osd_maps[_osd_maps.size() - 1];
-  auto &map = pair.second;
+  auto snapshot = _current();
+  if (nullptr == snapshot || snapshot->osd_maps.empty()) {
+    return nullptr;
+  }
+  auto &map = snapshot->osd_maps.back().second;
   const auto &ic = map.find(osd);
   if (ic == map.end()) {
     return nullptr;
@@ -51,99 +247,300 @@ std::shared_ptr<info_caps> OsdAccess::_find_osd(osd_t osd) {
   }
 }
 
+bool OsdAccess::_fetch_(const std::function<void(osd_maps_t &)> &fetch) {
+  ALBA_LOG(INFO, "OsdAccess::update:: filling up");
+  osd_maps_t infos;
+  try {
+    fetch(infos);
+  } catch (std::exception &e) {
+    ALBA_LOG(INFO,
+             "OSDAccess::update: exception while filling up: " << e.what());
+    return false;
+  }
+  auto snapshot = std::make_shared<osd_snapshot>();
+  for (auto &p : infos) {
+    snapshot->alba_levels.push_back(p.first);
+  }
+  snapshot->osd_maps = std::move(infos);
+  _prewarm(*snapshot);
+  std::atomic_store(&_snapshot,
+                    std::shared_ptr<const osd_snapshot>(std::move(snapshot)));
+  return true;
+}
+
+asd::ConnectionPool *OsdAccess::_connection_pool(const info_caps &ic) {
+  return asd_connection_pools.get_connection_pool(
+      ic.first, _connection_pool_size, _timeout, _adaptive_timeout,
+      std::max(0, _connection_pool_min_size), ic.second, _hedge_percentile);
+}
+
+void OsdAccess::_prewarm(const osd_snapshot &snapshot) {
+  if ((_connection_pool_min_size <= 0 && asd_connection_pools.budget() == 0) ||
+      snapshot.osd_maps.empty()) {
+    return;
+  }
+  // the pools of the asds reads go to fill up from there, the others
+  // aren't opened at all
+  asd_connection_pools.start_maintenance(_keepalive);
+}
+
 bool OsdAccess::update(Proxy_client &client) {
-  bool result = true;
-  if (!_filling.load()) {
-    ALBA_LOG(INFO, "OsdAccess::update:: filling up");
-    std::lock_guard<std::mutex> f_lock(_filling_mutex);
-    if (!_filling.load()) {
-      _filling.store(true);
-      try {
-        std::lock_guard<std::mutex> lock(_osd_maps_mutex);
-        osd_maps_t infos;
-        client.osd_info2(infos);
-        _alba_levels.clear();
-        _osd_maps.clear();
-        for (auto &p : infos) {
-          _alba_levels.push_back(std::string(p.first));
-          _osd_maps.push_back(std::move(p));
-        }
-      } catch (std::exception &e) {
-        ALBA_LOG(INFO,
-                 "OSDAccess::update: exception while filling up: " << e.what());
-        result = false;
+  auto seen = _current();
+  if (nullptr != seen && _request_refresh()) {
+    return true;
+  }
+  std::lock_guard<std::mutex> lock(_update_mutex);
+  if (_current() != seen) {
+    // someone else just did it
+    return true;
+  }
+  return _fetch_([&client](osd_maps_t &infos) { client.osd_info2(infos); });
+}
+
+bool OsdAccess::_request_refresh() {
+  std::lock_guard<std::mutex> lock(_refresh_mutex);
+  if (!_source) {
+    return false;
+  }
+  _refresh_requested = true;
+  _refresh_cond.notify_all();
+  return true;
+}
+
+void OsdAccess::set_osd_info_source(
+    std::function<void(osd_maps_t &)> source) {
+  std::lock_guard<std::mutex> lock(_refresh_mutex);
+  if (_source) {
+    return;
+  }
+  _source = std::move(source);
+  _refresh_thread = std::thread([this]() {
+    std::unique_lock<std::mutex> lock(_refresh_mutex);
+    auto wake = [this]() { return _stopping || _refresh_requested; };
+    while (!_stopping) {
+      if (_refresh_interval.count() > 0) {
+        _refresh_cond.wait_for(lock, _refresh_interval, wake);
+      } else {
+        _refresh_cond.wait(lock, wake);
+      }
+      if (_stopping) {
+        break;
       }
-      _filling.store(false);
-      _filling_cond.notify_all();
+      _refresh_requested = false;
+      lock.unlock();
+      {
+        std::lock_guard<std::mutex> u_lock(_update_mutex);
+        _fetch_(_source);
+      }
+      lock.lock();
     }
-  } else {
-    std::unique_lock<std::mutex> lock(_filling_mutex);
-    _filling_cond.wait(lock, [this] { return (this->_filling.load()); });
-  }
-  return result;
+  });
 }
 
-std::vector<alba_id_t> OsdAccess::get_alba_levels(Proxy_client &client) {
-  if (_alba_levels.size() == 0) {
-    if (!this->update(client)) {
+alba_levels_t OsdAccess::get_alba_levels(Proxy_client &client) {
+  auto snapshot = _current();
+  if (nullptr == snapshot) {
+    if (!this->update(client) || nullptr == (snapshot = _current())) {
       throw osd_access_exception(
           -1, "initial update of osd infos in osd_access failed");
     }
   }
-  return _alba_levels;
+  // shares ownership of the snapshot, no copy
+  return alba_levels_t(snapshot, &snapshot->alba_levels);
 }
 
 int OsdAccess::read_osds_slices(
-    std::map<osd_t, std::vector<asd_slice>> &per_osd) {
+    std::map<osd_t, std::vector<asd_slice>> &per_osd,
+    std::set<std::string> *missing) {
+
+  std::set<std::string> ignored;
+  if (nullptr == missing) {
+    missing = &ignored;
+  }
+  if (per_osd.size() == 1 || _read_pool.size() == 0) {
+    int rc = 0;
+    for (auto &item : per_osd) {
+      rc = _read_osd_slices_asd_direct_path(item.first, item.second, *missing);
+      if (rc) {
+        break;
+      }
+    }
+    return rc;
+  }
 
-  int rc = 0;
+  // all osds are read concurrently; the result is the first failure in
+  // osd order, like it would be for a sequential read
+  std::vector<int> rcs(per_osd.size(), 0);
+  std::vector<std::set<std::string>> missings(per_osd.size());
+  std::vector<std::function<void()>> tasks;
+  tasks.reserve(per_osd.size());
+  size_t i = 0;
   for (auto &item : per_osd) {
+    int &rc = rcs[i];
+    auto &osd_missing = missings[i];
+    i++;
     osd_t osd = item.first;
     auto &osd_slices = item.second;
-    // TODO this could be done in parallel
-    rc = _read_osd_slices_asd_direct_path(osd, osd_slices);
+    tasks.push_back([this, &rc, &osd_missing, osd, &osd_slices]() {
+      rc = _read_osd_slices_asd_direct_path(osd, osd_slices, osd_missing);
+    });
+  }
+  _read_pool.run(tasks);
+
+  for (auto &osd_missing : missings) {
+    missing->insert(osd_missing.begin(), osd_missing.end());
+  }
+  for (int rc : rcs) {
     if (rc) {
-      break;
+      return rc;
+    }
+  }
+  return 0;
+}
+
+void OsdAccess::start_reads(std::shared_ptr<osd_reads> &reads, int group,
+                            std::map<osd_t, std::vector<asd_slice>> &per_osd) {
+  std::vector<osd_reads::read *> started;
+  {
+    std::lock_guard<std::mutex> lock(reads->_mutex);
+    for (auto &item : per_osd) {
+      reads->_reads.push_back(osd_reads::read{item.first, item.second, group,
+                                              0, false, false, nullptr});
+      started.push_back(&reads->_reads.back());
     }
   }
-  return rc;
+  for (auto r : started) {
+    _read_pool.submit([this, reads, r]() {
+      int rc;
+      std::set<std::string> missing;
+      try {
+        rc = _read_osd_slices_asd_direct_path(r->osd, r->slices, missing,
+                                              reads.get(), r);
+      } catch (std::exception &e) {
+        ALBA_LOG(INFO, "exception in start_reads for osd " << r->osd << " "
+                                                           << e.what());
+        rc = -1;
+      }
+      reads->_finished(*r, rc, missing);
+    });
+  }
 }
 
-int OsdAccess::_read_osd_slices_asd_direct_path(
-    osd_t osd, std::vector<asd_slice> &slices) {
+boost::optional<std::chrono::steady_clock::duration> OsdAccess::hedge_delay(
+    const std::map<osd_t, std::vector<asd_slice>> &per_osd) {
+  boost::optional<std::chrono::steady_clock::duration> delay;
+  if (_hedge_percentile <= 0) {
+    return delay;
+  }
+  for (auto &item : per_osd) {
+    auto ic = _find_osd(item.first);
+    auto p = nullptr == ic ? nullptr : _connection_pool(*ic);
+    auto latency = nullptr == p ? boost::none : p->hedge_latency();
+    if (latency != boost::none && (delay == boost::none || *latency > *delay)) {
+      delay = latency;
+    }
+  }
+  if (delay != boost::none) {
+    delay = std::max(_hedge_min_delay, *delay);
+  }
+  return delay;
+}
+
+int OsdAccess::_read_osd_slices_asd_direct_path(osd_t osd,
+                                                std::vector<asd_slice> &slices,
+                                                std::set<std::string> &missing,
+                                                osd_reads *reads,
+                                                osd_reads::read *read) {
   auto maybe_ic = _find_osd(osd);
   if (nullptr == maybe_ic) {
     ALBA_LOG(WARNING, "have context, but no info?");
     return -1;
   }
-  auto p = asd_connection_pools.get_connection_pool(
-      maybe_ic->first, _connection_pool_size, _timeout);
+  auto p = _connection_pool(*maybe_ic);
   if (nullptr == p) {
     return -1;
   }
   auto connection = p->get_connection();
 
   if (connection) {
+    if (reads) {
+      std::lock_guard<std::mutex> lock(reads->_mutex);
+      if (read->cancelled) {
+        p->release_connection(std::move(connection));
+        return -1;
+      }
+      read->connection = connection.get();
+    }
+    // a cancelled read aborted the connection; that's not the asd's fault,
+    // and the connection can't be reused
+    auto cancelled = [reads, read]() {
+      if (nullptr == reads) {
+        return false;
+      }
+      std::lock_guard<std::mutex> lock(reads->_mutex);
+      read->connection = nullptr;
+      return read->cancelled;
+    };
+    auto key_reads = plan_key_reads(slices);
+    std::vector<asd_client::partial_get_request> requests;
+    requests.reserve(key_reads.size());
+    for (auto &kr : key_reads) {
+      requests.emplace_back(kr.key, kr.slices);
+    }
+    // one latency sample per response, not per batch
+    auto t0 = std::chrono::steady_clock::now();
+    auto report_latencies = [&]() {
+      for (auto &r : requests) {
+        if (r.latency == std::chrono::steady_clock::duration(0)) {
+          break;
+        }
+        p->report_latency(r.latency);
+        t0 += r.latency;
+      }
+    };
     try {
-      // TODO 1 batch call...
-      for (auto &slice_ : slices) {
-        alba::asd_protocol::slice slice__;
-        slice__.offset = slice_.offset;
-        slice__.length = slice_.len;
-        slice__.target = slice_.target;
-        std::vector<alba::asd_protocol::slice> slices_{slice__};
-        connection->partial_get(slice_.key, slices_);
+      connection->partial_gets(requests, _pipeline_depth);
+      if (cancelled()) {
+        p->drop_connection(std::move(connection));
+        return -1;
       }
+      report_latencies();
       p->release_connection(std::move(connection));
-      return 0;
+
+      // a missing fragment usually means the manifest is outdated
+      int rc = 0;
+      for (size_t i = 0; i < requests.size(); i++) {
+        if (!requests[i].success) {
+          ALBA_LOG(INFO, "_read_osd_slices_asd_direct_path: osd "
+                             << osd << " doesn't have the fragment");
+          missing.insert(requests[i].key);
+          rc = -3;
+          continue;
+        }
+        key_reads[i].finish();
+      }
+      return rc;
     } catch (std::exception &e) {
+      if (cancelled()) {
+        p->drop_connection(std::move(connection));
+        return -1;
+      }
+      report_latencies();
+      // a timeout is a sample too, or the timeout could never grow
+      auto timeout = connection->timeout();
+      if (std::chrono::steady_clock::now() - t0 >= timeout) {
+        p->report_latency(timeout);
+      }
+      p->drop_connection(std::move(connection));
       p->report_failure();
       ALBA_LOG(INFO, "exception in _read_osd_slices_asd_direct_path for osd "
                          << osd << " " << e.what());
       return -1;
     }
   } else {
-    // asd was disqualified
+    // the asd's circuit breaker is open, it can't be reached, or there's
+    // no idle connection yet. the caller falls back, the breaker doesn't
+    // count it
     return -2;
   }
 }
@@ -105,7 +105,7 @@ template <> void from(message &m, proxy_protocol::OsdCapabilities &caps) {
       std::string transport;
       from(m, transport);
       caps.rora_transport.emplace(transport);
-    }
+    }; break;
     default: {
       if (length == 0) {
         throw deserialisation_exception("OsdCapabilities");
@@ -17,6 +17,7 @@ but WITHOUT ANY WARRANTY of any kind.
 */
 
 #include "proxy_client.h"
+#include "manifest_cache.h"
 #include "rora_proxy_client.h"
 
 #include "transport_helper.h"
@@ -53,6 +54,11 @@ make_proxy_client(const std::string &ip, const std::string &port,
     return std::unique_ptr<Proxy_client>(inner_client.release());
   } else {
     ALBA_LOG(INFO, "make_proxy_client( rora_config=" << *rora_config << " )");
+    // background refreshes use a connection of their own
+    OsdAccess::getInstance(*rora_config)
+        .set_osd_info_source([ip, port, timeout, transport](osd_maps_t &infos) {
+          _make_proxy_client(ip, port, timeout, transport)->osd_info2(infos);
+        });
     return std::unique_ptr<Proxy_client>(
         new RoraProxy_client(std::move(inner_client), *rora_config));
   }
@@ -64,10 +70,67 @@ void Proxy_client::apply_sequence(const std::string &namespace_,
   this->apply_sequence(namespace_, write_barrier, seq._asserts, seq._updates);
 }
 
+size_t Proxy_client::prefetch_manifests(
+    const std::string &namespace_, const std::string &first,
+    const include_first include_first_,
+    const boost::optional<std::string> &last,
+    const include_last include_last_) {
+  size_t fetched = 0;
+  std::string from = first;
+  include_first finc = include_first_;
+  while (true) {
+    auto r = this->list_objects(namespace_, from, finc, last, include_last_,
+                                1000);
+    auto &names = std::get<0>(r);
+    fetched += this->prefetch_manifests(namespace_, names);
+    if (std::get<1>(r) == has_more::F || names.empty()) {
+      break;
+    }
+    from = names.back();
+    finc = include_first::F;
+  }
+  return fetched;
+}
+
+void stop_manifest_cache_snapshots() {
+  ManifestCache::getInstance().stop_snapshots();
+}
+
 std::ostream &operator<<(std::ostream &os, const RoraConfig &cfg) {
   os << "RoraConfig{"
      << " manifest_cache_size= " << cfg.manifest_cache_size
-     << ", asd_connection_pool_size= " << cfg.asd_connection_pool_size << " }";
+     << ", manifest_cache_bytes= " << cfg.manifest_cache_bytes
+     << ", lazy_manifest_decoding= " << cfg.lazy_manifest_decoding
+     << ", manifest_cache_file= " << cfg.manifest_cache_file
+     << ", manifest_cache_snapshot_seconds= "
+     << cfg.manifest_cache_snapshot_seconds
+     << ", manifest_cache_snapshot_max_age= "
+     << cfg.manifest_cache_snapshot_max_age
+     << ", validate_consistent_reads= " << cfg.validate_consistent_reads
+     << ", asd_connection_pool_size= " << cfg.asd_connection_pool_size
+     << ", asd_partial_read_timeout_milliseconds= "
+     << cfg.asd_partial_read_timeout_milliseconds
+     << ", asd_read_parallelism= " << cfg.asd_read_parallelism
+     << ", asd_pipeline_depth= " << cfg.asd_pipeline_depth
+     << ", asd_connection_pool_min_size= "
+     << cfg.asd_connection_pool_min_size
+     << ", asd_keepalive_seconds= " << cfg.asd_keepalive_seconds
+     << ", asd_connection_budget= " << cfg.asd_connection_budget
+     << ", osd_info_refresh_seconds= " << cfg.osd_info_refresh_seconds
+     << ", asd_hedge_percentile= " << cfg.asd_hedge_percentile
+     << ", asd_hedge_min_delay_microseconds= "
+     << cfg.asd_hedge_min_delay_microseconds
+     << ", asd_timeout_p99_multiplier= " << cfg.asd_timeout_p99_multiplier
+     << ", asd_timeout_floor_milliseconds= "
+     << cfg.asd_timeout_floor_milliseconds
+     << ", asd_timeout_ceiling_milliseconds= "
+     << cfg.asd_timeout_ceiling_milliseconds
+     << ", decompressed_fragment_cache_size= "
+     << cfg.decompressed_fragment_cache_size
+     << ", fragment_cache_bytes= " << cfg.fragment_cache_bytes
+     << ", fragment_cache_file= " << cfg.fragment_cache_file
+     << ", fragment_cache_file_bytes= " << cfg.fragment_cache_file_bytes
+     << " }";
   return os;
 }
 }
@@ -326,9 +326,27 @@ void _read_object_infos(message &m, std::vector<object_info> &object_infos) {
   }
 }
 
-void read_read_objects_slices2_response(
+void _read_object_infos(message &m,
+                        std::vector<serialized_object_info> &object_infos) {
+  uint32_t size;
+  from(m, size);
+  object_infos.reserve(size);
+  for (uint32_t i = 0; i < size; i++) {
+    std::string name;
+    from(m, name);
+    std::string future;
+    from(m, future);
+    std::unique_ptr<SerializedManifest> smf(new SerializedManifest());
+    from(m, *smf);
+    object_infos.push_back(
+        std::make_tuple(std::move(name), std::move(future), std::move(smf)));
+  }
+}
+
+template <typename T>
+void _read_read_objects_slices2_response(
     message &m, Status &status, const std::vector<ObjectSlices> &objects_slices,
-    std::vector<object_info> &object_infos) {
+    std::vector<T> &object_infos) {
   read_status(m, status);
   if (status.is_ok()) {
     uint32_t size;
@@ -345,6 +363,18 @@ void read_read_objects_slices2_response(
   }
 }
 
+void read_read_objects_slices2_response(
+    message &m, Status &status, const std::vector<ObjectSlices> &objects_slices,
+    std::vector<object_info> &object_infos) {
+  _read_read_objects_slices2_response(m, status, objects_slices, object_infos);
+}
+
+void read_read_objects_slices2_response(
+    message &m, Status &status, const std::vector<ObjectSlices> &objects_slices,
+    std::vector<serialized_object_info> &object_infos) {
+  _read_read_objects_slices2_response(m, status, objects_slices, object_infos);
+}
+
 void write_update_session_request(
     message_builder &mb,
     const std::vector<std::pair<std::string, boost::optional<std::string>>>
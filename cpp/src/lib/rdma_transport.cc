@@ -202,6 +202,11 @@ void RDMA_transport::expires_from_now(
                << " ms)");
 }
 
+void RDMA_transport::cancel() {
+  // wakes up a pending rpoll
+  rshutdown(_socket, SHUT_RDWR);
+}
+
 RDMA_transport::~RDMA_transport() {
   ALBA_LOG(INFO, "~RDMA_transport");
   int r = rclose(_socket);
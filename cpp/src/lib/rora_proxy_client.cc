@@ -19,11 +19,16 @@ but WITHOUT ANY WARRANTY of any kind.
 #include "rora_proxy_client.h"
 #include "alba_logger.h"
 #include "asd_client.h"
+#include "erasure.h"
+#include "fragment_cache.h"
 #include "manifest.h"
 #include "manifest_cache.h"
 #include "osd_access.h"
 
+#include <cstring>
 #include <gcrypt.h>
+#include <snappy.h>
+#include <tuple>
 
 namespace alba {
 namespace proxy_client {
@@ -32,7 +37,8 @@ using std::string;
 RoraProxy_client::RoraProxy_client(
     std::unique_ptr<GenericProxy_client> delegate,
     const RoraConfig &rora_config)
-    : _delegate(std::move(delegate)), _use_null_io(rora_config.use_null_io),
+    : _delegate(std::move(delegate)), _rora_config(rora_config),
+      _use_null_io(rora_config.use_null_io),
       _asd_connection_pool_size(rora_config.asd_connection_pool_size),
       _asd_partial_read_timeout(std::chrono::milliseconds(
           rora_config.asd_partial_read_timeout_milliseconds)),
@@ -46,7 +52,13 @@ RoraProxy_client::RoraProxy_client(
   ALBA_LOG(INFO, "RoraProxy_client( _asd_connection_pool_size = "
                      << _asd_connection_pool_size << " ...)");
   ManifestCache::getInstance().set_capacity(rora_config.manifest_cache_size);
-  _fast_path_failures = 0;
+  ManifestCache::getInstance().set_byte_capacity(
+      rora_config.manifest_cache_bytes);
+  if (rora_config.decompressed_fragment_cache_size > 0) {
+    _plain_fragments.reset(
+        new ovs::SafeLRUCache<string, std::shared_ptr<const string>>(
+            rora_config.decompressed_fragment_cache_size));
+  }
   try {
     _has_local_fragment_cache = _delegate->has_local_fragment_cache();
   } catch (alba::proxy_client::proxy_exception &e) {
@@ -86,6 +98,16 @@ RoraProxy_client::RoraProxy_client(
       throw e;
     }
   }
+
+  if (rora_config.manifest_cache_file != "") {
+    auto alba_levels =
+        OsdAccess::getInstance(_rora_config).get_alba_levels(*this);
+    ManifestCache::getInstance().start_snapshots(
+        rora_config.manifest_cache_file,
+        std::chrono::seconds(rora_config.manifest_cache_snapshot_seconds),
+        *alba_levels,
+        std::chrono::seconds(rora_config.manifest_cache_snapshot_max_age));
+  }
 }
 
 bool RoraProxy_client::namespace_exists(const string &name) {
@@ -152,28 +174,6 @@ std::tuple<std::vector<string>, has_more> RoraProxy_client::list_objects(
                                  include_last_, max, reverse_);
 }
 
-string RoraProxy_client::_fragment_key(const namespace_t namespace_id,
-                                       const string &object_id,
-                                       uint32_t version_id, uint32_t chunk_id,
-                                       uint32_t fragment_id) {
-  char instance_content_prefix = 'p';
-  _fkb.add_raw(&instance_content_prefix, 1);
-  uint32_t zero = 0;
-  to(_fkb, zero);
-  char namespace_char = 'n';
-  _fkb.add_raw(&namespace_char, 1);
-  alba::to_be(_fkb, namespace_id);
-  char prefix = 'o';
-  _fkb.add_raw(&prefix, 1);
-  to(_fkb, object_id);
-  to(_fkb, chunk_id);
-  to(_fkb, fragment_id);
-  to(_fkb, version_id);
-  string r = _fkb.as_string_no_size();
-  _fkb.reset();
-  return r;
-}
-
 void _dump(std::map<osd_t, std::vector<asd_slice>> &per_osd) {
   std::cout << "_dump per_osd.size()=" << per_osd.size();
   for (auto &item : per_osd) {
@@ -196,8 +196,7 @@ void RoraProxy_client::_maybe_update_osd_infos(
 
   ALBA_LOG(DEBUG, "RoraProxy_client::_maybe_update_osd_infos(_)");
   bool ok = true;
-  auto &access = OsdAccess::getInstance(_asd_connection_pool_size,
-                                        _asd_partial_read_timeout);
+  auto &access = OsdAccess::getInstance(_rora_config);
   for (auto &item : per_osd) {
     osd_t osd = item.first;
     if (access.osd_is_unknown(osd)) {
@@ -212,58 +211,42 @@ void RoraProxy_client::_maybe_update_osd_infos(
   }
 }
 
-Location get_location(ManifestWithNamespaceId &mf, uint64_t pos, uint32_t len) {
-  int chunk_index = -1;
-  uint64_t total = 0;
-
-  {
-    auto it = mf.chunk_sizes.begin();
-    while (total <= pos) {
-      chunk_index++;
-      auto chunk_size = *it;
-      total += chunk_size;
-      it++;
+namespace {
+// walks the slice from the chunk holding its start, in a single pass.
+// false if the slice runs past the end of the object.
+bool _resolve_slice_one_level(std::vector<std::pair<byte *, Location>> &results,
+                              const manifest_cache_entry &mfp,
+                              uint64_t offset, uint32_t length, byte *target) {
+  auto &mf = *mfp;
+  const uint32_t k = mf.encoding_scheme.k;
+  const bool uses_compression = mf.compressor != compressor_t::NO_COMPRESSION;
+  for (uint32_t chunk_id = mf.chunk_at(offset);
+       length > 0 && chunk_id < mf.chunk_sizes.size(); chunk_id++) {
+    uint32_t fragment_length = mf.chunk_sizes[chunk_id] / k;
+    uint32_t pos_in_chunk = offset - mf.chunk_offset(chunk_id);
+    uint32_t fragment_id = pos_in_chunk / fragment_length;
+    uint32_t pos_in_fragment = pos_in_chunk - fragment_id * fragment_length;
+    for (; length > 0 && fragment_id < k; fragment_id++) {
+      Location l;
+      l.namespace_id = mf.namespace_id;
+      l.chunk_id = chunk_id;
+      l.fragment_id = fragment_id;
+      l.fragment_location = mf.location(chunk_id, fragment_id);
+      l.offset = pos_in_fragment;
+      l.length = std::min(length, fragment_length - pos_in_fragment);
+      l.uses_compression = uses_compression;
+      l.manifest = mfp;
+
+      results.emplace_back(target, std::move(l));
+      auto len = results.back().second.length;
+      length -= len;
+      offset += len;
+      target += len;
+      pos_in_fragment = 0;
     }
   }
-
-  auto &chunk_fragments = mf.fragments[chunk_index];
-
-  uint32_t chunk_size = mf.chunk_sizes[chunk_index];
-  total -= chunk_size;
-  uint32_t fragment_length = chunk_size / mf.encoding_scheme.k;
-  uint32_t pos_in_chunk = pos - total;
-
-  uint32_t fragment_index = pos_in_chunk / fragment_length;
-  auto &fragment = chunk_fragments[fragment_index];
-
-  total += fragment_length * fragment_index;
-  uint32_t pos_in_fragment = pos - total;
-
-  Location l;
-  l.namespace_id = mf.namespace_id;
-  l.object_id = mf.object_id;
-  l.chunk_id = chunk_index;
-  l.fragment_id = fragment_index;
-  l.fragment_location = fragment->loc;
-  l.offset = pos_in_fragment;
-  l.length = std::min(len, fragment_length - pos_in_fragment);
-  l.uses_compression =
-      mf.compression->get_compressor() != compressor_t::NO_COMPRESSION;
-  l.encrypt_info = mf.encrypt_info;
-  l.ctr = fragment->ctr;
-  return l;
+  return length == 0;
 }
-
-void _resolve_slice_one_level(std::vector<std::pair<byte *, Location>> &results,
-                              ManifestWithNamespaceId &manifest,
-                              uint64_t offset, uint32_t length, byte *target) {
-  while (length > 0) {
-    results.emplace_back(target, get_location(manifest, offset, length));
-    auto len = results.back().second.length;
-    length -= len;
-    offset += len;
-    target += len;
-  };
 }
 
 boost::optional<std::vector<std::pair<byte *, Location>>>
@@ -279,9 +262,14 @@ _resolve_one_level(const alba_id_t &alba_id, const std::string &namespace_,
     ALBA_LOG(DEBUG, "manifest for alba_id=" << alba_id << ", obj_slices="
                                             << obj_slices << " found");
     std::vector<std::pair<byte *, Location>> results;
+    results.reserve(obj_slices.slices.size());
     for (auto &slice : obj_slices.slices) {
-      _resolve_slice_one_level(results, *mf, slice.offset, slice.size,
-                               slice.buf);
+      if (!_resolve_slice_one_level(results, mf, slice.offset, slice.size,
+                                    slice.buf)) {
+        ALBA_LOG(WARNING, "slice " << slice << " beyond the end of "
+                                   << obj_slices.object_name);
+        return boost::none;
+      }
     }
     return results;
   }
@@ -303,7 +291,7 @@ _resolve_one_many_levels(const std::vector<alba_id_t> &alba_levels,
       for (auto &buf_l : *locations) {
         auto &l = std::get<1>(buf_l);
         message_builder mb;
-        to(mb, l.object_id);
+        to(mb, l.manifest->object_id);
         to(mb, l.chunk_id);
         to(mb, l.fragment_id);
         SliceDescriptor slice{std::get<0>(buf_l), l.offset, l.length};
@@ -332,48 +320,526 @@ _resolve_one_many_levels(const std::vector<alba_id_t> &alba_levels,
   }
 }
 
-int RoraProxy_client::_short_path(
-    const std::vector<std::pair<byte *, Location>> &locations) {
+bool RoraProxy_client::_fragment_is_readable(
+    const fragment_location_t &fragment_location) {
+  return fragment_location.first != boost::none &&
+         !OsdAccess::getInstance(_rora_config)
+              .osd_is_unavailable(*fragment_location.first);
+}
 
-  ALBA_LOG(DEBUG, "_short_path locations.size()=" << locations.size());
+namespace {
+// compressed and cbc encrypted data can only be unpacked as a whole
+bool _needs_whole_fragment(const Location &l) {
+  return l.uses_compression ||
+         !l.manifest->encrypt_info->supports_partial_decrypt();
+}
 
-  std::map<osd_t, std::vector<asd_slice>> per_osd;
+// erasure.cc only decodes GF(2^8)
+bool _decodable(const Location &l) {
+  return l.manifest->encoding_scheme.w == 8;
+}
+}
 
-  for (auto &bl : locations) {
-    auto &target = std::get<0>(bl);
-    auto &l = std::get<1>(bl);
+std::vector<uint32_t> reconstruction_sources(
+    const Location &l,
+    const std::function<bool(const fragment_location_t &)> &usable) {
+  std::vector<uint32_t> fragment_ids;
+  if (!_decodable(l)) {
+    return fragment_ids;
+  }
+  auto &mf = *l.manifest;
+  const uint32_t k = mf.encoding_scheme.k;
+  for (uint32_t fragment_id = 0;
+       fragment_id < mf.fragment_count() && fragment_ids.size() < k;
+       fragment_id++) {
+    if (usable(mf.location(l.chunk_id, fragment_id))) {
+      fragment_ids.push_back(fragment_id);
+    }
+  }
+  if (fragment_ids.size() < k) {
+    fragment_ids.clear();
+  }
+  return fragment_ids;
+}
 
-    osd_t osd_id = *l.fragment_location.first;
-    uint32_t version_id = l.fragment_location.second;
+bool RoraProxy_client::_can_read(const Location &l) {
+  if (_needs_whole_fragment(l)) {
+    // no reconstruction from partial reads either
+    return (!l.uses_compression ||
+            l.manifest->compressor == compressor_t::SNAPPY) &&
+           _fragment_is_readable(l.fragment_location);
+  }
+  if (_fragment_is_readable(l.fragment_location)) {
+    return true;
+  }
+  return !reconstruction_sources(l, [this](const fragment_location_t &loc) {
+            return _fragment_is_readable(loc);
+          }).empty();
+}
+
+bool RoraProxy_client::_plan_reconstruction(
+    byte *target, const Location &l, const std::set<osd_t> &avoid,
+    std::vector<reconstruction> &reconstructions,
+    std::map<osd_t, std::vector<asd_slice>> &per_osd) {
+  auto fragment_ids =
+      reconstruction_sources(l, [&](const fragment_location_t &loc) {
+        return _fragment_is_readable(loc) && avoid.count(*loc.first) == 0;
+      });
+  if (fragment_ids.empty()) {
+    return false;
+  }
+  reconstruction r;
+  r.target = target;
+  r.location = l;
+  r.fragment_ids = fragment_ids;
+  auto &mf = *l.manifest;
+  for (auto fragment_id : fragment_ids) {
+    r.buffers.emplace_back(l.length);
 
     asd_slice slice;
     slice.offset = l.offset;
     slice.len = l.length;
-    slice.target = target;
-    string key = _fragment_key(l.namespace_id, l.object_id, version_id,
-                               l.chunk_id, l.fragment_id);
-    slice.key = key;
+    slice.target = r.buffers.back().data();
+    slice.key = mf.fragment_key(l.chunk_id, fragment_id);
+    per_osd[*mf.location(l.chunk_id, fragment_id).first].push_back(
+        std::move(slice));
+  }
+  // moving the buffers doesn't move their data
+  reconstructions.push_back(std::move(r));
+  return true;
+}
+
+std::map<osd_t, std::vector<asd_slice>> RoraProxy_client::_plan_short_path(
+    std::vector<std::pair<byte *, Location>> &locations,
+    std::vector<reconstruction> &reconstructions,
+    std::vector<packed_fragment> &packed,
+    std::set<const CompactManifest *> &unplanned, const alba_id_t &alba_id,
+    alba::statistics::RoraCounter &cntr) {
+
+  ALBA_LOG(DEBUG, "_plan_short_path locations.size()=" << locations.size());
+  auto &fragment_cache = FragmentCache::getInstance(_rora_config);
+
+  std::map<osd_t, std::vector<asd_slice>> per_osd;
+  std::vector<std::pair<byte *, Location>> direct;
+  direct.reserve(locations.size());
+  std::unordered_map<string, size_t> packed_index;
 
-    auto it = per_osd.find(osd_id);
-    if (it == per_osd.end()) {
-      std::vector<asd_slice> slices;
-      per_osd[osd_id] = slices;
-      it = per_osd.find(osd_id);
+  for (auto &bl : locations) {
+    auto &target = std::get<0>(bl);
+    auto &l = std::get<1>(bl);
+
+    if (fragment_cache.enabled() && !_needs_whole_fragment(l)) {
+      if (fragment_cache.find(_fragment_cache_key(alba_id, l), l.offset,
+                              l.length, target)) {
+        cntr.fragment_cache_hits++;
+        continue;
+      }
+      cntr.fragment_cache_misses++;
     }
-    auto &slices = it->second;
-    slices.push_back(slice);
+
+    if (_needs_whole_fragment(l)) {
+      string key = l.manifest->fragment_key(l.chunk_id, l.fragment_id);
+      string cache_key = alba_id + key;
+      auto it = packed_index.find(cache_key);
+      if (it == packed_index.end()) {
+        it = packed_index.emplace(cache_key, packed.size()).first;
+        packed.emplace_back();
+        auto &p = packed.back();
+        p.cache_key = cache_key;
+        p.location = l;
+        if (_plain_fragments) {
+          auto cached = _plain_fragments->find(cache_key);
+          if (cached != boost::none) {
+            p.plain = *cached;
+          }
+        }
+        if (p.plain == nullptr) {
+          uint32_t len =
+              l.manifest->fragment_length(l.chunk_id, l.fragment_id);
+          p.data.resize(len);
+          asd_slice slice;
+          slice.offset = 0;
+          slice.len = len;
+          slice.target = p.data.data();
+          slice.key = key;
+          per_osd[*l.fragment_location.first].push_back(slice);
+        }
+      }
+      packed[it->second].slices.push_back(bl);
+    } else if (_fragment_is_readable(l.fragment_location)) {
+      osd_t osd_id = *l.fragment_location.first;
+
+      asd_slice slice;
+      slice.offset = l.offset;
+      slice.len = l.length;
+      slice.target = target;
+      slice.key = l.manifest->fragment_key(l.chunk_id, l.fragment_id);
+      per_osd[osd_id].push_back(slice);
+      direct.push_back(bl);
+    } else {
+      // read the same range from k other fragments of the chunk,
+      // the missing data is decoded from those.
+      ALBA_LOG(DEBUG, "_plan_short_path: reconstructing chunk "
+                          << l.chunk_id << ", fragment " << l.fragment_id);
+      if (!_plan_reconstruction(target, l, {}, reconstructions, per_osd)) {
+        // readability changed since _can_read
+        unplanned.insert(l.manifest.get());
+      }
+    }
+  }
+  locations.swap(direct);
+  if (!unplanned.empty()) {
+    _unplan(unplanned, locations, reconstructions, packed, per_osd);
   }
 
   // everything to read is now nicely sorted per osd.
   _maybe_update_osd_infos(per_osd);
   //_dump(per_osd);
+  return per_osd;
+}
+
+void RoraProxy_client::_unplan(
+    const std::set<const CompactManifest *> &manifests,
+    std::vector<std::pair<byte *, Location>> &direct,
+    std::vector<reconstruction> &reconstructions,
+    std::vector<packed_fragment> &packed,
+    std::map<osd_t, std::vector<asd_slice>> &per_osd) {
+  auto unplanned = [&manifests](const Location &l) {
+    return manifests.count(l.manifest.get()) > 0;
+  };
+  std::set<byte *> targets;
+  for (auto &bl : direct) {
+    if (unplanned(bl.second)) {
+      targets.insert(bl.first);
+    }
+  }
+  for (auto &r : reconstructions) {
+    if (unplanned(r.location)) {
+      for (auto &buffer : r.buffers) {
+        targets.insert(buffer.data());
+      }
+    }
+  }
+  for (auto &p : packed) {
+    if (unplanned(p.location)) {
+      targets.insert(p.data.data());
+    }
+  }
+
+  direct.erase(std::remove_if(direct.begin(), direct.end(),
+                              [&](const std::pair<byte *, Location> &bl) {
+                                return unplanned(bl.second);
+                              }),
+               direct.end());
+  reconstructions.erase(
+      std::remove_if(reconstructions.begin(), reconstructions.end(),
+                     [&](const reconstruction &r) {
+                       return unplanned(r.location);
+                     }),
+      reconstructions.end());
+  packed.erase(std::remove_if(packed.begin(), packed.end(),
+                              [&](const packed_fragment &p) {
+                                return unplanned(p.location);
+                              }),
+               packed.end());
+  for (auto it = per_osd.begin(); it != per_osd.end();) {
+    auto &slices = it->second;
+    slices.erase(std::remove_if(slices.begin(), slices.end(),
+                                [&targets](const asd_slice &slice) {
+                                  return targets.count(slice.target) > 0;
+                                }),
+                 slices.end());
+    it = slices.empty() ? per_osd.erase(it) : std::next(it);
+  }
+}
+
+bool RoraProxy_client::_decrypt(byte *buf, uint32_t len, uint32_t offset,
+                                const Location &l,
+                                const boost::optional<string> &ctr,
+                                const alba_id_t &alba_id) {
+  switch (l.manifest->encrypt_info->get_encryption()) {
+  case encryption_t::NO_ENCRYPTION:
+    return true;
+  case encryption_t::ENCRYPTED:
+    auto encrypt_info =
+        static_cast<encryption::Encrypted *>(l.manifest->encrypt_info.get());
+
+    if (ctr == boost::none) {
+      ALBA_LOG(ERROR, "ctr==boost::none while doing ctr partial decrypt");
+      return false;
+    }
+
+    auto enc_key = get_encryption_key(alba_id, l.namespace_id,
+                                      encrypt_info->key_identification);
+    string ctr_ = *ctr;
+    if (!encrypt_info->partial_decrypt(buf, len, enc_key, ctr_, offset)) {
+      ALBA_LOG(ERROR,
+               "Could not partially decrypt data, which is unexpected!");
+      return false;
+    }
+  }
+  return true;
+}
+
+string RoraProxy_client::_fragment_cache_key(const alba_id_t &alba_id,
+                                             const Location &l) {
+  return alba_id + l.manifest->fragment_key(l.chunk_id, l.fragment_id);
+}
+
+void RoraProxy_client::_fill_fragment_cache(
+    const std::vector<std::pair<byte *, Location>> &short_path,
+    const std::vector<reconstruction> &reconstructions,
+    const alba_id_t &alba_id) {
+  auto &fragment_cache = FragmentCache::getInstance(_rora_config);
+  if (!fragment_cache.enabled() || _use_null_io) {
+    return;
+  }
+  for (auto &bl : short_path) {
+    auto &l = bl.second;
+    fragment_cache.add(_fragment_cache_key(alba_id, l), l.offset, l.length,
+                       bl.first);
+  }
+  for (auto &r : reconstructions) {
+    auto &l = r.location;
+    fragment_cache.add(_fragment_cache_key(alba_id, l), l.offset, l.length,
+                       r.target);
+  }
+}
+
+bool RoraProxy_client::_decrypt_short_path(
+    std::vector<std::pair<byte *, Location>> &short_path,
+    const alba_id_t &alba_id) {
+  struct fragment_slices {
+    const encryption::Encrypted *encrypt_info;
+    string enc_key;
+    string ctr;
+    std::vector<encryption::ctr_slice> slices;
+  };
+  std::vector<fragment_slices> per_fragment;
+  std::map<std::tuple<const CompactManifest *, uint32_t, uint32_t>, size_t>
+      index;
+  size_t total = 0;
+  for (auto &bl : short_path) {
+    auto &l = bl.second;
+    if (l.manifest->encrypt_info->get_encryption() ==
+        encryption_t::NO_ENCRYPTION) {
+      continue;
+    }
+    auto fragment =
+        std::make_tuple(l.manifest.get(), l.chunk_id, l.fragment_id);
+    auto it = index.find(fragment);
+    if (it == index.end()) {
+      auto ctr = l.manifest->ctr(l.chunk_id, l.fragment_id);
+      if (ctr == boost::none) {
+        ALBA_LOG(ERROR, "ctr==boost::none while doing ctr partial decrypt");
+        return false;
+      }
+      auto encrypt_info =
+          static_cast<encryption::Encrypted *>(l.manifest->encrypt_info.get());
+      it = index.emplace(fragment, per_fragment.size()).first;
+      per_fragment.push_back(fragment_slices{
+          encrypt_info,
+          get_encryption_key(alba_id, l.namespace_id,
+                             encrypt_info->key_identification),
+          *ctr, {}});
+    }
+    per_fragment[it->second].slices.push_back(
+        encryption::ctr_slice{bl.first, l.length, l.offset});
+    total += l.length;
+  }
+
+  std::vector<char> ok(per_fragment.size(), 1);
+  auto decrypt = [&per_fragment, &ok](size_t i) {
+    auto &f = per_fragment[i];
+    if (!f.encrypt_info->partial_decrypt(f.slices, f.enc_key, f.ctr)) {
+      ALBA_LOG(ERROR,
+               "Could not partially decrypt data, which is unexpected!");
+      ok[i] = 0;
+    }
+  };
+  // spreading small amounts over threads costs more than it gains
+  if (per_fragment.size() > 1 && total >= 256 * 1024) {
+    std::vector<std::function<void()>> tasks;
+    for (size_t i = 0; i < per_fragment.size(); i++) {
+      tasks.push_back([&decrypt, i]() { decrypt(i); });
+    }
+    OsdAccess::getInstance(_rora_config).get_worker_pool().run(tasks);
+  } else {
+    for (size_t i = 0; i < per_fragment.size(); i++) {
+      decrypt(i);
+    }
+  }
+  return std::all_of(ok.begin(), ok.end(), [](char b) { return b != 0; });
+}
+
+bool RoraProxy_client::_reconstruct(reconstruction &r,
+                                    const alba_id_t &alba_id) {
+  auto &l = r.location;
+  auto &mf = *l.manifest;
+  std::vector<const byte *> sources;
+  for (size_t i = 0; i < r.fragment_ids.size(); i++) {
+    if (!_decrypt(r.buffers[i].data(), l.length, l.offset, l,
+                  mf.ctr(l.chunk_id, r.fragment_ids[i]), alba_id)) {
+      return false;
+    }
+    sources.push_back(r.buffers[i].data());
+  }
+  auto coefficients = erasure::decoding_coefficients(
+      mf.encoding_scheme.k, mf.encoding_scheme.m, r.fragment_ids,
+      l.fragment_id);
+  erasure::combine(coefficients, sources, r.target, l.length);
+  return true;
+}
+
+bool RoraProxy_client::_unpack(packed_fragment &p, const alba_id_t &alba_id) {
+  if (p.plain == nullptr) {
+    auto &l = p.location;
+    uint32_t len = p.data.size();
+    if (l.manifest->encrypt_info->supports_partial_decrypt()) {
+      if (!_decrypt(p.data.data(), len, 0, l,
+                    l.manifest->ctr(l.chunk_id, l.fragment_id), alba_id)) {
+        return false;
+      }
+    } else {
+      auto encrypt_info =
+          static_cast<encryption::Encrypted *>(l.manifest->encrypt_info.get());
+      auto enc_key = get_encryption_key(alba_id, l.namespace_id,
+                                        encrypt_info->key_identification);
+      uint32_t fragment_id =
+          l.manifest->encoding_scheme.k == 1 ? 0 : l.fragment_id;
+      if (!encrypt_info->cbc_decrypt_fragment(p.data.data(), len, enc_key,
+                                              l.manifest->object_id, l.chunk_id,
+                                              fragment_id)) {
+        ALBA_LOG(ERROR, "Could not decrypt fragment, which is unexpected!");
+        return false;
+      }
+    }
+
+    const char *data = (const char *)p.data.data();
+    if (l.uses_compression) {
+      size_t size;
+      if (!snappy::GetUncompressedLength(data, len, &size)) {
+        ALBA_LOG(ERROR, "_unpack: corrupt snappy data");
+        return false;
+      }
+      auto decompressed = std::make_shared<string>(size, '\0');
+      if (!snappy::RawUncompress(data, len, &(*decompressed)[0])) {
+        ALBA_LOG(ERROR, "_unpack: corrupt snappy data");
+        return false;
+      }
+      p.plain = decompressed;
+    } else {
+      p.plain = std::make_shared<const string>(data, len);
+    }
+    if (_plain_fragments) {
+      _plain_fragments->insert(p.cache_key, p.plain);
+    }
+  }
+  for (auto &bl : p.slices) {
+    auto &l = bl.second;
+    if (l.offset + l.length > p.plain->size()) {
+      ALBA_LOG(ERROR, "_unpack: fragment is shorter than expected");
+      return false;
+    }
+    std::memcpy(bl.first, p.plain->data() + l.offset, l.length);
+  }
+  return true;
+}
+
+int RoraProxy_client::_short_path(
+    std::map<osd_t, std::vector<asd_slice>> &per_osd,
+    std::vector<std::pair<byte *, Location>> &short_path,
+    std::vector<reconstruction> &reconstructions,
+    const std::vector<packed_fragment> &packed, std::set<std::string> &missing,
+    alba::statistics::RoraCounter &cntr) {
   if (_use_null_io) {
     return 0;
-  } else {
-    return OsdAccess::getInstance(_asd_connection_pool_size,
-                                  _asd_partial_read_timeout)
-        .read_osds_slices(per_osd);
   }
+  auto &access = OsdAccess::getInstance(_rora_config);
+  auto hedge_delay = access.hedge_delay(per_osd);
+  if (hedge_delay == boost::none) {
+    return access.read_osds_slices(per_osd, &missing);
+  }
+
+  auto reads = std::make_shared<osd_reads>();
+  auto result = [&reads, &missing]() {
+    missing = reads->missing();
+    return reads->result(0);
+  };
+  access.start_reads(reads, 0, per_osd);
+  if (reads->wait(0, steady_clock::now() + *hedge_delay)) {
+    return result();
+  }
+
+  // some osds are slow: plan reading whatever depends on them from other
+  // fragments, and use whichever finishes first.
+  auto slow = reads->pending(0);
+  std::vector<reconstruction> hedges;
+  std::map<osd_t, std::vector<asd_slice>> hedge_per_osd;
+  std::vector<bool> hedged_direct(short_path.size(), false);
+  std::vector<bool> hedged_reconstructions(reconstructions.size(), false);
+  // compressed fragments can't be reconstructed from partial reads, nor
+  // can chunks that aren't GF(2^8) encoded
+  bool can_hedge =
+      std::none_of(packed.begin(), packed.end(),
+                   [&slow](const packed_fragment &p) {
+                     return p.plain == nullptr &&
+                            slow.count(*p.location.fragment_location.first);
+                   }) &&
+      std::none_of(short_path.begin(), short_path.end(),
+                   [&slow](const std::pair<byte *, Location> &bl) {
+                     return slow.count(*bl.second.fragment_location.first) &&
+                            !_decodable(bl.second);
+                   });
+  for (size_t i = 0; can_hedge && i < short_path.size(); i++) {
+    auto &l = short_path[i].second;
+    if (slow.count(*l.fragment_location.first)) {
+      hedged_direct[i] = true;
+      can_hedge = _plan_reconstruction(short_path[i].first, l, slow, hedges,
+                                       hedge_per_osd);
+    }
+  }
+  for (size_t i = 0; can_hedge && i < reconstructions.size(); i++) {
+    auto &r = reconstructions[i];
+    auto &mf = *r.location.manifest;
+    if (std::any_of(r.fragment_ids.begin(), r.fragment_ids.end(),
+                    [&](uint32_t fragment_id) {
+                      auto loc = mf.location(r.location.chunk_id, fragment_id);
+                      return slow.count(*loc.first);
+                    })) {
+      hedged_reconstructions[i] = true;
+      can_hedge = _plan_reconstruction(r.target, r.location, slow, hedges,
+                                       hedge_per_osd);
+    }
+  }
+  if (!can_hedge || hedge_per_osd.empty()) {
+    reads->wait(0, steady_clock::time_point::max());
+    return result();
+  }
+
+  cntr.hedged++;
+  access.start_reads(reads, 1, hedge_per_osd);
+  if (reads->race(0, 1) != 1) {
+    reads->cancel(1);
+    return result();
+  }
+  reads->cancel(0);
+  cntr.hedge_wins++;
+
+  std::vector<std::pair<byte *, Location>> direct;
+  for (size_t i = 0; i < short_path.size(); i++) {
+    if (!hedged_direct[i]) {
+      direct.push_back(std::move(short_path[i]));
+    }
+  }
+  short_path.swap(direct);
+  for (size_t i = 0; i < reconstructions.size(); i++) {
+    if (!hedged_reconstructions[i]) {
+      hedges.push_back(std::move(reconstructions[i]));
+    }
+  }
+  reconstructions.swap(hedges);
+  return 0;
 }
 
 void RoraProxy_client::_process(std::vector<object_info> &object_infos,
@@ -384,25 +850,52 @@ void RoraProxy_client::_process(std::vector<object_info> &object_infos,
     using alba::stuff::operator<<;
 
     manifest_cache_entry manifest_cache_entry_ =
-        std::shared_ptr<alba::proxy_protocol::ManifestWithNamespaceId>(
-            std::get<2>(object_info).release());
+        std::make_shared<const CompactManifest>(*std::get<2>(object_info));
     string alba_id = std::get<1>(object_info);
     if (alba_id == "") {
-      alba_id = OsdAccess::getInstance(_asd_connection_pool_size,
-                                       _asd_partial_read_timeout)
-                    .get_alba_levels(*this)
-                    .at(0);
+      alba_id =
+          OsdAccess::getInstance(_rora_config).get_alba_levels(*this)->at(0);
     }
     ManifestCache::getInstance().add(namespace_, alba_id,
                                      std::move(manifest_cache_entry_));
   }
 }
 
-void RoraProxy_client::_slow_path(const std::string &namespace_,
-                                  const std::vector<ObjectSlices> &slices,
-                                  const consistent_read consistent_read_,
-                                  std::vector<object_info> &object_infos,
-                                  alba::statistics::RoraCounter &cntr) {
+void RoraProxy_client::_process(
+    std::vector<serialized_object_info> &object_infos,
+    const string &namespace_) {
+  ALBA_LOG(DEBUG, "_process : " << object_infos.size());
+  auto &cache = ManifestCache::getInstance();
+  for (auto &object_info : object_infos) {
+    string alba_id = std::get<1>(object_info);
+    if (alba_id == "") {
+      alba_id =
+          OsdAccess::getInstance(_rora_config).get_alba_levels(*this)->at(0);
+    }
+    std::shared_ptr<const SerializedManifest> serialized(
+        std::move(std::get<2>(object_info)));
+    if (_rora_config.lazy_manifest_decoding) {
+      cache.add(namespace_, alba_id, std::move(std::get<0>(object_info)),
+                std::move(serialized));
+      continue;
+    }
+    try {
+      auto decoded =
+          std::make_shared<const CompactManifest>(*serialized->decode());
+      cache.add(namespace_, alba_id, std::move(std::get<0>(object_info)),
+                std::move(serialized), std::move(decoded));
+    } catch (llio::deserialisation_exception &e) {
+      ALBA_LOG(WARNING, "skipping name=" << std::get<0>(object_info)
+                                         << " because of " << e.what());
+    }
+  }
+}
+
+void RoraProxy_client::_slow_path(
+    const std::string &namespace_, const std::vector<ObjectSlices> &slices,
+    const consistent_read consistent_read_,
+    std::vector<serialized_object_info> &object_infos,
+    alba::statistics::RoraCounter &cntr) {
   _delegate->read_objects_slices2(namespace_, slices, consistent_read_,
                                   object_infos, cntr);
 }
@@ -412,83 +905,118 @@ void RoraProxy_client::read_objects_slices(
     const consistent_read consistent_read_,
     alba::statistics::RoraCounter &cntr) {
 
-  bool use_slow_path =
+  // the proxy's fragment cache can be ahead of our manifests
+  bool validate =
       (consistent_read_ == consistent_read::T) && _has_local_fragment_cache;
-  if (_fast_path_failures > 100) {
-    if (duration_cast<seconds>(steady_clock::now() - _failure_time).count() >
-        120) {
-      // try to start using fast path again after 2 minutes
-      _fast_path_failures = 0;
-    } else {
-      use_slow_path = true;
-    }
-  }
+  // unhealthy osds are avoided per object (see _can_read), by their
+  // circuit breakers
+  bool use_slow_path = validate && !_rora_config.validate_consistent_reads;
 
   if (use_slow_path) {
-    std::vector<object_info> object_infos;
+    std::vector<serialized_object_info> object_infos;
     _slow_path(namespace_, slices, consistent_read_, object_infos, cntr);
     _process(object_infos, namespace_);
 
   } else {
     std::vector<std::pair<byte *, Location>> short_path;
+    std::vector<ObjectSlices> via_short_path;
     std::vector<ObjectSlices> via_proxy;
-    auto alba_levels = OsdAccess::getInstance(_asd_connection_pool_size,
-                                              _asd_partial_read_timeout)
-                           .get_alba_levels(*this);
+    // objects of via_short_path by the manifests their locations use
+    std::multimap<const CompactManifest *, size_t> objects;
+    auto levels = OsdAccess::getInstance(_rora_config).get_alba_levels(*this);
+    auto &alba_levels = *levels;
     for (auto &object_slices : slices) {
       auto locations =
           _resolve_one_many_levels(alba_levels, 0, namespace_, object_slices);
       if (locations == boost::none ||
-          std::any_of(
-              locations->begin(), locations->end(),
-              [](std::pair<byte *, Location> &l) {
-                auto &location = std::get<1>(l);
-                return location.fragment_location.first == boost::none ||
-                       location.uses_compression ||
-                       !location.encrypt_info->supports_partial_decrypt();
-              })) {
+          std::any_of(locations->begin(), locations->end(),
+                      [this](std::pair<byte *, Location> &l) {
+                        return !_can_read(std::get<1>(l));
+                      })) {
         via_proxy.push_back(object_slices);
       } else {
         for (auto &l : *locations) {
+          objects.emplace(l.second.manifest.get(), via_short_path.size());
           short_path.push_back(l);
         }
+        via_short_path.push_back(object_slices);
       }
     }
 
-    // TODO: different paths could go in parallel
-    int result_front = _short_path(short_path);
+    // this may still need the proxy (osd infos), so it's done up front.
+    // from here on the delegate is only used by the slow path, which
+    // runs while the asds are being read.
+    std::vector<reconstruction> reconstructions;
+    std::vector<packed_fragment> packed;
+    auto cache_hits = cntr.fragment_cache_hits;
+    std::set<const CompactManifest *> unplanned;
+    auto per_osd = _plan_short_path(short_path, reconstructions, packed,
+                                    unplanned, alba_levels.back(), cntr);
+    cache_hits = cntr.fragment_cache_hits - cache_hits;
+    if (!unplanned.empty()) {
+      std::set<size_t> moved;
+      for (auto manifest : unplanned) {
+        auto range = objects.equal_range(manifest);
+        for (auto it = range.first; it != range.second; ++it) {
+          moved.insert(it->second);
+        }
+      }
+      std::vector<ObjectSlices> rest;
+      for (size_t i = 0; i < via_short_path.size(); i++) {
+        (moved.count(i) ? via_proxy : rest).push_back(via_short_path[i]);
+      }
+      via_short_path.swap(rest);
+    }
+
+    int result_front = 0;
+    std::set<std::string> missing;
+    bool valid = true;
+    validate = validate && !via_short_path.empty();
+    std::vector<serialized_object_info> object_infos;
+    std::vector<std::function<void()>> paths;
+    if (!per_osd.empty()) {
+      paths.push_back([&]() {
+        result_front = _short_path(per_osd, short_path, reconstructions,
+                                   packed, missing, cntr);
+      });
+    }
+    if (!via_proxy.empty() || validate) {
+      ALBA_LOG(DEBUG, "rora read_objects_slices going via proxy, size="
+                          << via_proxy.size());
+      paths.push_back([&]() {
+        if (validate) {
+          valid = _validate_manifests(namespace_, alba_levels.front(),
+                                      via_short_path);
+        }
+        if (!via_proxy.empty()) {
+          _slow_path(namespace_, via_proxy, consistent_read_, object_infos,
+                     cntr);
+        }
+      });
+    }
+    OsdAccess::getInstance(_rora_config).get_worker_pool().run(paths);
+    _process(object_infos, namespace_);
     ALBA_LOG(DEBUG, "_short_path result => " << result_front);
+    if (!valid && !result_front) {
+      // like missing fragments, outdated manifests
+      result_front = -3;
+    }
 
     if (!result_front) {
       // maybe decrypt data
       try {
-        for (auto &s : short_path) {
-          unsigned char *buf = s.first;
-          alba::proxy_protocol::Location &l = s.second;
-          switch (l.encrypt_info->get_encryption()) {
-          case encryption_t::NO_ENCRYPTION:
-            break;
-          case encryption_t::ENCRYPTED:
-            auto encrypt_info =
-                static_cast<encryption::Encrypted *>(l.encrypt_info.get());
-
-            if (l.ctr == boost::none) {
-              ALBA_LOG(ERROR, "ctr==boost::none while doing ctr partial decrypt");
-              throw 0;
-            }
-
-            auto enc_key =
-                get_encryption_key(alba_levels.back(), l.namespace_id,
-                                   encrypt_info->key_identification);
-
-            if (!encrypt_info->partial_decrypt(buf, l.length, enc_key, *l.ctr,
-                                               l.offset)) {
-              ALBA_LOG(
-                  ERROR,
-                  "Could not partially decrypt data, which is unexpected!");
-              throw 0;
-            }
-            break;
+        const alba_id_t &alba_id = alba_levels.back();
+        if (!_decrypt_short_path(short_path, alba_id)) {
+          result_front = -1;
+        }
+        for (size_t i = 0; !result_front && i < reconstructions.size(); i++) {
+          if (!_reconstruct(reconstructions[i], alba_id)) {
+            result_front = -1;
+          }
+        }
+        for (size_t i = 0; !result_front && i < packed.size(); i++) {
+          if (!_unpack(packed[i], alba_id)) {
+            result_front = -1;
           }
         }
       } catch (std::exception &e) {
@@ -500,27 +1028,25 @@ void RoraProxy_client::read_objects_slices(
       }
     }
 
-    if (result_front) {
-      _failure_time = std::chrono::steady_clock::now();
-      if (result_front != -2) {
-        // disqualified osds shouldn't result in disqualifying the fast path
-        _fast_path_failures++;
-      }
-      via_proxy.clear();
-      for (auto &s : slices) {
-        via_proxy.push_back(s);
-      }
-    } else {
-      _fast_path_failures = 0;
-      cntr.fast_path += short_path.size();
+    if (!missing.empty()) {
+      _invalidate_missing(namespace_, alba_levels.back(), missing, short_path,
+                          reconstructions, packed);
     }
-
-    if (via_proxy.size() > 0) {
-      ALBA_LOG(DEBUG, "rora read_objects_slices going via proxy, size="
-                          << via_proxy.size());
-      std::vector<object_info> object_infos;
-      _slow_path(namespace_, via_proxy, consistent_read_, object_infos, cntr);
+    if (result_front) {
+      // the osds' breakers saw their failures
+      ALBA_LOG(DEBUG, "rora read_objects_slices fast path failed, size="
+                          << via_short_path.size());
+      std::vector<serialized_object_info> object_infos;
+      _slow_path(namespace_, via_short_path, consistent_read_, object_infos,
+                 cntr);
       _process(object_infos, namespace_);
+    } else {
+      _fill_fragment_cache(short_path, reconstructions, alba_levels.back());
+      cntr.fast_path +=
+          short_path.size() + reconstructions.size() + cache_hits;
+      for (auto &p : packed) {
+        cntr.fast_path += p.slices.size();
+      }
     }
   }
 }
@@ -543,6 +1069,139 @@ void RoraProxy_client::apply_sequence(
   _process(object_infos, namespace_);
 }
 
+size_t RoraProxy_client::prefetch_manifests(
+    const string &namespace_, const std::vector<string> &object_names) {
+  // objects without slices, in batches: the proxy only looks up their
+  // manifests, which also works for empty objects
+  const size_t batch_size = 100;
+  size_t fetched = 0;
+  for (size_t i = 0; i < object_names.size(); i += batch_size) {
+    std::vector<ObjectSlices> batch;
+    for (size_t j = i; j < std::min(i + batch_size, object_names.size());
+         j++) {
+      batch.push_back(ObjectSlices{object_names[j], {}});
+    }
+    fetched += _prefetch_manifests(namespace_, batch);
+  }
+  ALBA_LOG(DEBUG, "prefetch_manifests: " << fetched << " of "
+                                         << object_names.size());
+  return fetched;
+}
+
+size_t
+RoraProxy_client::_prefetch_manifests(const string &namespace_,
+                                      const std::vector<ObjectSlices> &batch) {
+  std::vector<serialized_object_info> object_infos;
+  alba::statistics::RoraCounter cntr;
+  try {
+    _delegate->read_objects_slices2(namespace_, batch, consistent_read::F,
+                                    object_infos, cntr);
+  } catch (proxy_exception &e) {
+    if (batch.size() == 1) {
+      ALBA_LOG(DEBUG, "prefetch_manifests: skipping "
+                          << batch[0].object_name << ": " << e.what());
+      return 0;
+    }
+    // a missing object fails the whole batch: bisect to find it
+    auto half = batch.begin() + batch.size() / 2;
+    return _prefetch_manifests(namespace_, {batch.begin(), half}) +
+           _prefetch_manifests(namespace_, {half, batch.end()});
+  }
+  size_t fetched = object_infos.size();
+  _process(object_infos, namespace_);
+  return fetched;
+}
+
+bool RoraProxy_client::_validate_manifests(
+    const string &namespace_, const alba_id_t &alba_id,
+    const std::vector<ObjectSlices> &objects) {
+  // a consistent read without slices: one round trip, the proxy looks up
+  // the current manifests in the nsm without touching its write path
+  std::vector<ObjectSlices> no_slices;
+  for (auto &object_slices : objects) {
+    no_slices.push_back(ObjectSlices{object_slices.object_name, {}});
+  }
+  std::vector<serialized_object_info> object_infos;
+  alba::statistics::RoraCounter cntr;
+  try {
+    _delegate->read_objects_slices2(namespace_, no_slices, consistent_read::T,
+                                    object_infos, cntr);
+  } catch (proxy_exception &e) {
+    ALBA_LOG(DEBUG, "_validate_manifests: " << e.what());
+    return false;
+  }
+  auto &cache = ManifestCache::getInstance();
+  for (auto &object_info : object_infos) {
+    auto mf = cache.find(namespace_, alba_id, std::get<0>(object_info));
+    if (mf == nullptr) {
+      return false;
+    }
+    try {
+      auto current = std::get<2>(object_info)->decode();
+      if (current->object_id != mf->object_id ||
+          current->version_id != mf->version_id) {
+        return false;
+      }
+    } catch (llio::deserialisation_exception &e) {
+      ALBA_LOG(DEBUG, "_validate_manifests: " << e.what());
+      return false;
+    }
+  }
+  return object_infos.size() == objects.size();
+}
+
+void RoraProxy_client::_invalidate_missing(
+    const string &namespace_, const alba_id_t &alba_id,
+    const std::set<std::string> &missing,
+    const std::vector<std::pair<byte *, Location>> &short_path,
+    const std::vector<reconstruction> &reconstructions,
+    const std::vector<packed_fragment> &packed) {
+  std::set<const CompactManifest *> manifests;
+  for (auto &p : short_path) {
+    manifests.insert(p.second.manifest.get());
+  }
+  for (auto &r : reconstructions) {
+    manifests.insert(r.location.manifest.get());
+  }
+  for (auto &p : packed) {
+    manifests.insert(p.location.manifest.get());
+  }
+  auto &cache = ManifestCache::getInstance();
+  for (auto mf : manifests) {
+    bool affected = false;
+    for (uint32_t c = 0; !affected && c < mf->chunk_sizes.size(); c++) {
+      for (uint32_t f = 0; !affected && f < mf->fragment_count(); f++) {
+        affected = missing.count(mf->fragment_key(c, f)) > 0;
+      }
+    }
+    if (affected) {
+      ALBA_LOG(INFO, "fragment missing on the asd, dropping the manifest of "
+                         << mf->name);
+      cache.invalidate(namespace_, alba_id, mf->name);
+    }
+  }
+}
+
+void RoraProxy_client::invalidate_manifest(const string &namespace_,
+                                           const string &object_name) {
+  auto &cache = ManifestCache::getInstance();
+  auto alba_levels =
+      OsdAccess::getInstance(_rora_config).get_alba_levels(*this);
+  for (auto &alba_id : *alba_levels) {
+    cache.invalidate(namespace_, alba_id, object_name);
+  }
+}
+
+void RoraProxy_client::invalidate_manifests_with_prefix(
+    const string &namespace_, const string &prefix) {
+  ManifestCache::getInstance().invalidate_prefix(namespace_, prefix);
+}
+
+void RoraProxy_client::invalidate_manifests_older_than(
+    const string &namespace_, uint32_t version_id) {
+  ManifestCache::getInstance().invalidate_older(namespace_, version_id);
+}
+
 void RoraProxy_client::invalidate_cache(const std::string &namespace_) {
   ManifestCache::getInstance().invalidate_namespace(namespace_);
   _delegate->invalidate_cache(namespace_);
@@ -19,10 +19,12 @@ but WITHOUT ANY WARRANTY of any kind.
 #pragma once
 
 #include "generic_proxy_client.h"
+#include "lru_cache.h"
 #include "osd_access.h"
 #include "osd_info.h"
 #include "proxy_client.h"
 
+#include <functional>
 #include <unordered_map>
 
 namespace alba {
@@ -31,6 +33,13 @@ namespace proxy_client {
 using namespace proxy_protocol;
 using namespace std::chrono;
 
+// k fragments of the location's chunk, among the usable ones, to decode
+// it from. empty if there aren't k of them, or if the chunk isn't
+// encoded over GF(2^8), the only field erasure.cc decodes.
+std::vector<uint32_t> reconstruction_sources(
+    const Location &,
+    const std::function<bool(const fragment_location_t &)> &usable);
+
 class RoraProxy_client : public Proxy_client {
 public:
   RoraProxy_client(std::unique_ptr<GenericProxy_client> delegate,
@@ -83,6 +92,18 @@ public:
                  const std::vector<std::shared_ptr<sequences::Assert>> &,
                  const std::vector<std::shared_ptr<sequences::Update>> &);
 
+  virtual size_t
+  prefetch_manifests(const std::string &namespace_,
+                     const std::vector<std::string> &object_names);
+  using Proxy_client::prefetch_manifests;
+
+  virtual void invalidate_manifest(const std::string &namespace_,
+                                   const std::string &object_name);
+  virtual void invalidate_manifests_with_prefix(const std::string &namespace_,
+                                                const std::string &prefix);
+  virtual void invalidate_manifests_older_than(const std::string &namespace_,
+                                               uint32_t version_id);
+
   virtual void invalidate_cache(const std::string &namespace_);
 
   virtual void drop_cache(const std::string &namespace_);
@@ -102,34 +123,115 @@ public:
 
 private:
   std::unique_ptr<GenericProxy_client> _delegate;
+  const RoraConfig _rora_config;
 
   void _process(std::vector<object_info> &object_infos,
                 const string &namespace_);
+  void _process(std::vector<serialized_object_info> &object_infos,
+                const string &namespace_);
+  size_t _prefetch_manifests(const std::string &namespace_,
+                             const std::vector<ObjectSlices> &);
 
   void
   _maybe_update_osd_infos(std::map<osd_t, std::vector<asd_slice>> &per_osd);
 
-  int _short_path(const std::vector<std::pair<byte *, Location>> &);
+  // a slice of a data fragment that can't be read directly, decoded from
+  // the same range of k other fragments of the chunk.
+  struct reconstruction {
+    byte *target;
+    Location location;
+    std::vector<uint32_t> fragment_ids;
+    std::vector<std::vector<byte>> buffers;
+  };
+
+  // a compressed or cbc encrypted fragment, fetched whole (or found in the
+  // cache) and unpacked to serve the slices' ranges.
+  struct packed_fragment {
+    std::string cache_key;
+    Location location;
+    std::vector<byte> data;
+    std::shared_ptr<const std::string> plain;
+    std::vector<std::pair<byte *, Location>> slices;
+  };
+
+  bool _fragment_is_readable(const fragment_location_t &);
+  bool _can_read(const Location &);
+
+  // plans reading k fragments of the chunk, skipping the osds to avoid.
+  // false (and nothing planned) if there aren't k such fragments
+  bool _plan_reconstruction(byte *target, const Location &,
+                            const std::set<osd_t> &avoid,
+                            std::vector<reconstruction> &,
+                            std::map<osd_t, std::vector<asd_slice>> &per_osd);
+
+  // moves the locations that need reconstruction into the 2nd argument,
+  // and those that need the whole fragment into the 3rd. locations found
+  // in the fragment cache are served right away. objects with a location
+  // that can't be read after all are left out, their manifests returned
+  // in the 4th argument.
+  std::map<osd_t, std::vector<asd_slice>>
+  _plan_short_path(std::vector<std::pair<byte *, Location>> &,
+                   std::vector<reconstruction> &,
+                   std::vector<packed_fragment> &,
+                   std::set<const CompactManifest *> &unplanned,
+                   const alba_id_t &alba_id, alba::statistics::RoraCounter &);
+  // drops everything planned for locations of these manifests
+  void _unplan(const std::set<const CompactManifest *> &,
+               std::vector<std::pair<byte *, Location>> &,
+               std::vector<reconstruction> &, std::vector<packed_fragment> &,
+               std::map<osd_t, std::vector<asd_slice>> &per_osd);
+
+  string _fragment_cache_key(const alba_id_t &, const Location &);
+  // the plain data of what was just read
+  void
+  _fill_fragment_cache(const std::vector<std::pair<byte *, Location>> &,
+                       const std::vector<reconstruction> &,
+                       const alba_id_t &alba_id);
+
+  bool _decrypt(byte *buf, uint32_t len, uint32_t offset, const Location &,
+                const boost::optional<string> &ctr, const alba_id_t &alba_id);
+  // the direct reads, per fragment in one pass. large amounts are
+  // decrypted in parallel.
+  bool _decrypt_short_path(std::vector<std::pair<byte *, Location>> &,
+                           const alba_id_t &alba_id);
+  bool _reconstruct(reconstruction &, const alba_id_t &alba_id);
+  bool _unpack(packed_fragment &, const alba_id_t &alba_id);
+
+  // when hedging wins, the hedged locations are replaced by
+  // reconstructions from other fragments
+  int _short_path(std::map<osd_t, std::vector<asd_slice>> &per_osd,
+                  std::vector<std::pair<byte *, Location>> &short_path,
+                  std::vector<reconstruction> &reconstructions,
+                  const std::vector<packed_fragment> &packed,
+                  std::set<std::string> &missing,
+                  alba::statistics::RoraCounter &cntr);
+  // false unless the cached manifests of all objects are the current ones
+  bool _validate_manifests(const string &namespace_, const alba_id_t &alba_id,
+                           const std::vector<ObjectSlices> &);
+  // drops the manifests of objects with fragments the asds don't have
+  void _invalidate_missing(const string &namespace_, const alba_id_t &alba_id,
+                           const std::set<std::string> &missing,
+                           const std::vector<std::pair<byte *, Location>> &,
+                           const std::vector<reconstruction> &,
+                           const std::vector<packed_fragment> &);
 
   bool _use_null_io;
 
   bool _has_local_fragment_cache;
 
-  int _fast_path_failures;
-  steady_clock::time_point _failure_time;
-
   int _asd_connection_pool_size;
   std::chrono::steady_clock::duration _asd_partial_read_timeout;
 
-  message_builder _fkb;
-  string _fragment_key(const namespace_t namespace_id, const string &object_id,
-                       uint32_t version_id, uint32_t chunk_id,
-                       uint32_t fragment_id);
+  // by alba id + fragment key
+  std::unique_ptr<
+      ovs::SafeLRUCache<std::string, std::shared_ptr<const std::string>>>
+      _plain_fragments;
+
   boost::optional<int> _ser_version;
 
   void _slow_path(const std::string &namespace_,
                   const std::vector<ObjectSlices> &, const consistent_read,
-                  std::vector<object_info> &object_infos,
+                  std::vector<serialized_object_info> &object_infos,
                   alba::statistics::RoraCounter &);
 
   std::unordered_map<string, string> _enc_keys;
@@ -19,6 +19,8 @@ but WITHOUT ANY WARRANTY of any kind.
 #include "statistics.h"
 #include "stuff.h"
 
+#include <algorithm>
+
 namespace alba {
 namespace statistics {
 
@@ -95,5 +97,39 @@ std::ostream &operator<<(std::ostream &os, const Statistics &s) {
   os << " }";
   return os;
 }
+
+LatencyWindow::LatencyWindow(size_t capacity)
+    : _capacity(capacity), _next(0) {
+  _samples.reserve(capacity);
+}
+
+void LatencyWindow::add(steady_clock::duration d) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (_samples.size() < _capacity) {
+    _samples.push_back(d);
+  } else {
+    _samples[_next] = d;
+    _next = (_next + 1) % _capacity;
+  }
+}
+
+size_t LatencyWindow::size() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _samples.size();
+}
+
+steady_clock::duration LatencyWindow::percentile(double p) const {
+  std::vector<steady_clock::duration> copy;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    copy = _samples;
+  }
+  if (copy.empty()) {
+    return steady_clock::duration::zero();
+  }
+  size_t n = std::min(copy.size() - 1, (size_t)(p / 100.0 * copy.size()));
+  std::nth_element(copy.begin(), copy.begin() + n, copy.end());
+  return copy[n];
+}
 }
 }
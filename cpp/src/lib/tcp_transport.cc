@@ -137,6 +137,14 @@ void TCP_transport::read_exact(char *buf, int len) {
     throw boost::system::system_error(ec);
 }
 
+void TCP_transport::cancel() {
+  // the io_service is driven by the thread doing the read/write
+  _io_service.post([this]() {
+    boost::system::error_code ignored_ec;
+    _socket.close(ignored_ec);
+  });
+}
+
 void TCP_transport::_check_deadline() {
   if (_deadline.expires_at() <= deadline_timer::traits_type::now()) {
     boost::system::error_code ignored_ec;
@@ -0,0 +1,140 @@
+/*
+  Copyright (C) 2016 iNuron NV
+
+  This file is part of Open vStorage Open Source Edition (OSE), as available
+  from
+
+
+  http://www.openvstorage.org and
+  http://www.openvstorage.com.
+
+  This file is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Affero General Public License v3 (GNU AGPLv3)
+  as published by the Free Software Foundation, in version 3 as it comes
+  in the <LICENSE.txt> file of the Open vStorage OSE distribution.
+
+  Open vStorage is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY of any kind.
+*/
+
+#include "worker_pool.h"
+#include "alba_logger.h"
+
+#include <atomic>
+#include <exception>
+#include <memory>
+
+namespace alba {
+namespace worker_pool {
+
+WorkerPool::WorkerPool(size_t n_threads) : _stopping(false) {
+  for (size_t i = 0; i < n_threads; i++) {
+    _threads.emplace_back(&WorkerPool::_work, this);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stopping = true;
+  }
+  _cond.notify_all();
+  for (auto &t : _threads) {
+    t.join();
+  }
+}
+
+void WorkerPool::_work() {
+  while (true) {
+    std::function<void()> job;
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _cond.wait(lock, [this] { return _stopping || !_queue.empty(); });
+      if (_queue.empty()) {
+        return;
+      }
+      job = std::move(_queue.front());
+      _queue.pop_front();
+    }
+    try {
+      job();
+    } catch (std::exception &e) {
+      ALBA_LOG(WARNING, "WorkerPool: job threw " << e.what());
+    } catch (...) {
+      ALBA_LOG(WARNING, "WorkerPool: job threw");
+    }
+  }
+}
+
+void WorkerPool::submit(std::function<void()> job) {
+  if (_threads.empty()) {
+    job();
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _queue.push_back(std::move(job));
+  }
+  _cond.notify_one();
+}
+
+namespace {
+// shared between the caller and the workers helping out; a helper can be
+// scheduled after the caller already returned, hence the shared_ptr.
+struct batch {
+  explicit batch(std::vector<std::function<void()>> &tasks)
+      : tasks(tasks), n(tasks.size()), next(0), remaining(n) {}
+
+  std::vector<std::function<void()>> &tasks;
+  const size_t n;
+  std::atomic<size_t> next;
+  size_t remaining;
+  std::exception_ptr error;
+  std::mutex mutex;
+  std::condition_variable done;
+
+  void claim() {
+    size_t i;
+    while ((i = next.fetch_add(1)) < n) {
+      std::exception_ptr e;
+      try {
+        tasks[i]();
+      } catch (...) {
+        e = std::current_exception();
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      if (e && !error) {
+        error = e;
+      }
+      if (--remaining == 0) {
+        done.notify_all();
+      }
+    }
+  }
+};
+}
+
+void WorkerPool::run(std::vector<std::function<void()>> &tasks) {
+  if (tasks.size() == 0) {
+    return;
+  }
+  auto b = std::make_shared<batch>(tasks);
+  size_t helpers = std::min(tasks.size() - 1, _threads.size());
+  if (helpers > 0) {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      for (size_t i = 0; i < helpers; i++) {
+        _queue.push_back([b]() { b->claim(); });
+      }
+    }
+    _cond.notify_all();
+  }
+  b->claim();
+  std::unique_lock<std::mutex> lock(b->mutex);
+  b->done.wait(lock, [&b] { return b->remaining == 0; });
+  if (b->error) {
+    std::rethrow_exception(b->error);
+  }
+}
+}
+}
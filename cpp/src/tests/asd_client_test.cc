@@ -74,6 +74,35 @@ TEST(asd_client, partial_read) {
   EXPECT_EQ(0, memcmp(target, expected_target, 50));
 }
 
+TEST(asd_client, partial_gets) {
+  const steady_clock::duration timeout = seconds(1);
+  auto asd = make_client(timeout);
+
+  const int n = 5;
+  byte targets[n][50];
+  vector<vector<slice>> slices(n);
+  vector<string> keys{"key1", "key1", "does_not_exist", "key1", "key1"};
+  vector<alba::asd_client::partial_get_request> requests;
+  for (int i = 0; i < n; i++) {
+    memset(targets[i], (int)'b', 50);
+    slices[i].push_back(slice{0, 50, targets[i]});
+    requests.emplace_back(keys[i], slices[i]);
+  }
+
+  asd->partial_gets(requests, 2);
+
+  byte expected_target[50];
+  memset(expected_target, (int)'a', 50);
+  for (int i = 0; i < n; i++) {
+    if (i == 2) {
+      EXPECT_FALSE(requests[i].success);
+    } else {
+      EXPECT_TRUE(requests[i].success);
+      EXPECT_EQ(0, memcmp(targets[i], expected_target, 50));
+    }
+  }
+}
+
 void _dump_version(std::tuple<int32_t, int32_t, int32_t, std::string> &v) {
   int32_t major = std::get<0>(v);
   int32_t minor = std::get<1>(v);
@@ -133,3 +162,221 @@ TEST(asd_access, get_connection) {
   auto c = p.get_connection();
   EXPECT_EQ(nullptr, c);
 }
+
+TEST(asd_access, maintain_unreachable) {
+  using namespace alba::proxy_protocol;
+  auto info = std::unique_ptr<OsdInfo>(new OsdInfo);
+  info->ips = std::vector<string>{"127.0.0.1"};
+  info->port = 64000;
+  info->use_rdma = false;
+
+  alba::asd::ConnectionPool p(std::move(info), 5, milliseconds(25),
+                              alba::asd::AdaptiveTimeout(), 2);
+  // nothing to connect to: the pool stays empty, and nothing is thrown
+  p.maintain();
+  EXPECT_EQ(0u, p.size());
+}
+
+TEST(asd_access, capacity_follows_demand) {
+  using namespace alba::proxy_protocol;
+  auto info = std::unique_ptr<OsdInfo>(new OsdInfo);
+  info->ips = std::vector<string>{"127.0.0.1"};
+  info->port = 64000;
+  info->use_rdma = false;
+
+  alba::asd::ConnectionPool p(std::move(info), 3, milliseconds(25));
+  p.maintain();
+  EXPECT_EQ(3u, p.capacity());
+  // not used since the last pass
+  p.maintain();
+  EXPECT_EQ(2u, p.capacity());
+  p.maintain();
+  p.maintain();
+  EXPECT_EQ(1u, p.capacity());
+  // found the pool empty
+  p.get_connection();
+  p.maintain();
+  EXPECT_EQ(2u, p.capacity());
+}
+
+TEST(asd_access, capacity_decays_to_zero) {
+  using namespace alba::proxy_protocol;
+  auto info = std::unique_ptr<OsdInfo>(new OsdInfo);
+  info->ips = std::vector<string>{"127.0.0.1"};
+  info->port = 64000;
+  info->use_rdma = false;
+
+  alba::asd::ConnectionPool p(std::move(info), 2, milliseconds(25));
+  p.maintain();
+  p.maintain();
+  EXPECT_EQ(1u, p.capacity());
+  // the last connection stays a while longer
+  for (size_t i = 2; i < alba::asd::ConnectionPool::idle_passes; i++) {
+    p.maintain();
+  }
+  EXPECT_EQ(1u, p.capacity());
+  p.maintain();
+  EXPECT_EQ(0u, p.capacity());
+  // until a read wants one again
+  p.get_connection();
+  EXPECT_EQ(1u, p.capacity());
+}
+
+TEST(asd_access, miss_without_connecting) {
+  using namespace alba::proxy_protocol;
+  OsdInfo info;
+  info.kind_asd = true;
+  info.long_id = "miss_without_connecting";
+  info.ips = std::vector<string>{"127.0.0.1"};
+  info.port = 64000;
+  info.use_rdma = false;
+
+  alba::asd::ConnectionPools pools;
+  pools.start_maintenance(std::chrono::hours(1));
+  auto p = pools.get_connection_pool(info, 3, milliseconds(25),
+                                     alba::asd::AdaptiveTimeout(), 1);
+  // the maintenance thread connects, not the reads: their failures
+  // would have opened the breaker
+  for (int i = 0; i < 20; i++) {
+    EXPECT_EQ(nullptr, p->get_connection());
+  }
+  EXPECT_EQ(alba::asd::CircuitBreaker::State::closed, p->breaker_state());
+}
+
+TEST(asd_access, circuit_breaker) {
+  using State = alba::asd::CircuitBreaker::State;
+  alba::asd::CircuitBreaker b(3, seconds(1), seconds(4));
+  auto t = steady_clock::now();
+  b.failure(t);
+  b.failure(t);
+  b.success();
+  b.failure(t);
+  b.failure(t);
+  EXPECT_EQ(State::closed, b.state());
+  b.failure(t);
+  EXPECT_EQ(State::open, b.state());
+  EXPECT_FALSE(b.allow(t + milliseconds(500)));
+
+  // one probe after the backoff
+  EXPECT_TRUE(b.allow(t + seconds(1)));
+  EXPECT_EQ(State::half_open, b.state());
+  EXPECT_FALSE(b.allow(t + seconds(1)));
+
+  // a failed probe doubles the backoff, up to the max
+  t += seconds(1);
+  b.failure(t);
+  EXPECT_FALSE(b.would_allow(t + seconds(1)));
+  EXPECT_TRUE(b.allow(t + seconds(2)));
+  t += seconds(2);
+  b.failure(t);
+  EXPECT_TRUE(b.allow(t + seconds(4)));
+  t += seconds(4);
+  b.failure(t);
+  EXPECT_TRUE(b.would_allow(t + seconds(4)));
+
+  // a probe that never reports back is retried
+  EXPECT_TRUE(b.allow(t + seconds(4)));
+  EXPECT_TRUE(b.allow(t + seconds(8)));
+  b.success();
+  EXPECT_EQ(State::closed, b.state());
+  EXPECT_EQ(4u, b.trips());
+}
+
+TEST(asd_access, adaptive_timeout) {
+  using namespace alba::proxy_protocol;
+  auto info = std::unique_ptr<OsdInfo>(new OsdInfo);
+  info->ips = std::vector<string>{"127.0.0.1"};
+  info->port = 64000;
+  info->use_rdma = false;
+
+  alba::asd::AdaptiveTimeout adaptive;
+  adaptive.multiplier = 2;
+  adaptive.floor = milliseconds(5);
+  adaptive.ceiling = milliseconds(100);
+  adaptive.min_samples = 10;
+  alba::asd::ConnectionPool p(std::move(info), 5, milliseconds(25), adaptive);
+
+  // not enough history yet
+  EXPECT_EQ(p.timeout(), milliseconds(25));
+  for (int i = 0; i < 10; i++) {
+    p.report_latency(milliseconds(10));
+  }
+  EXPECT_EQ(p.timeout(), milliseconds(20));
+
+  // a fast asd times out quickly, but not below the floor
+  for (int i = 0; i < 300; i++) {
+    p.report_latency(microseconds(100));
+  }
+  EXPECT_EQ(p.timeout(), milliseconds(5));
+
+  // a slow one gets more time, up to the ceiling
+  for (int i = 0; i < 300; i++) {
+    p.report_latency(milliseconds(80));
+  }
+  EXPECT_EQ(p.timeout(), milliseconds(100));
+}
+
+TEST(asd_access, hedge_latency) {
+  using namespace alba::proxy_protocol;
+  auto info = std::unique_ptr<OsdInfo>(new OsdInfo);
+  info->ips = std::vector<string>{"127.0.0.1"};
+  info->port = 64000;
+  info->use_rdma = false;
+
+  alba::asd::ConnectionPool p(std::move(info), 5, milliseconds(25),
+                              alba::asd::AdaptiveTimeout(), 0, nullptr,
+                              OsdCapabilities(), 50);
+  for (int i = 0; i < 63; i++) {
+    p.report_latency(milliseconds(i < 32 ? 1 : 3));
+  }
+  // only refreshed once there's enough history
+  EXPECT_FALSE(p.hedge_latency());
+  p.report_latency(milliseconds(3));
+  ASSERT_TRUE(p.hedge_latency());
+  EXPECT_EQ(milliseconds(3), *p.hedge_latency());
+}
+
+TEST(asd_access, endpoints) {
+  using namespace alba::proxy_protocol;
+  using alba::transport::Kind;
+  OsdInfo info;
+  info.ips = std::vector<string>{"10.0.0.1", "10.0.0.2"};
+  info.port = 8000;
+  info.use_rdma = false;
+
+  // nothing advertised: the regular endpoints only
+  OsdCapabilities caps;
+  auto es = alba::asd::endpoints(info, caps);
+  ASSERT_EQ(2u, es.size());
+  EXPECT_EQ("10.0.0.1", es[0].ip);
+  EXPECT_EQ("8000", es[0].port);
+  EXPECT_EQ(Kind::tcp, es[0].kind);
+  EXPECT_FALSE(es[0].rora);
+
+  // a rora port on the regular ips, with the advertised transport
+  caps.rora_port = 9000;
+  caps.rora_transport = string("RDMA");
+  es = alba::asd::endpoints(info, caps);
+  ASSERT_EQ(4u, es.size());
+  EXPECT_EQ("10.0.0.1", es[0].ip);
+  EXPECT_EQ("9000", es[0].port);
+  EXPECT_EQ(Kind::rdma, es[0].kind);
+  EXPECT_TRUE(es[0].rora);
+  EXPECT_EQ("10.0.0.2", es[1].ip);
+  EXPECT_TRUE(es[1].rora);
+  EXPECT_EQ("8000", es[2].port);
+  EXPECT_EQ(Kind::tcp, es[2].kind);
+  EXPECT_FALSE(es[3].rora);
+
+  // dedicated rora ips
+  caps.rora_transport = boost::none;
+  caps.rora_ips = std::vector<string>{"192.168.0.1"};
+  es = alba::asd::endpoints(info, caps);
+  ASSERT_EQ(3u, es.size());
+  EXPECT_EQ("192.168.0.1", es[0].ip);
+  EXPECT_EQ("9000", es[0].port);
+  EXPECT_EQ(Kind::tcp, es[0].kind);
+  EXPECT_TRUE(es[0].rora);
+  EXPECT_EQ("10.0.0.1", es[1].ip);
+  EXPECT_FALSE(es[1].rora);
+}
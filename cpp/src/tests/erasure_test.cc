@@ -0,0 +1,107 @@
+/*
+  Copyright (C) 2016 iNuron NV
+
+  This file is part of Open vStorage Open Source Edition (OSE), as available
+  from
+
+
+  http://www.openvstorage.org and
+  http://www.openvstorage.com.
+
+  This file is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Affero General Public License v3 (GNU AGPLv3)
+  as published by the Free Software Foundation, in version 3 as it comes
+  in the <LICENSE.txt> file of the Open vStorage OSE distribution.
+
+  Open vStorage is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY of any kind.
+*/
+
+#include "erasure.h"
+#include "gtest/gtest.h"
+#include <cstdlib>
+#include <cstring>
+
+using namespace alba::erasure;
+using alba::byte;
+
+TEST(erasure, distribution_matrix_shape) {
+  for (uint32_t k : {1, 2, 4, 8, 12}) {
+    for (uint32_t m : {1, 2, 3, 4}) {
+      auto d = distribution_matrix(k, m);
+      ASSERT_EQ((k + m) * k, d.size());
+      for (uint32_t i = 0; i < k; i++) {
+        for (uint32_t j = 0; j < k; j++) {
+          EXPECT_EQ(i == j ? 1 : 0, d[i * k + j]);
+        }
+      }
+      // first coding row is all ones, as is the first column of the others
+      for (uint32_t j = 0; j < k; j++) {
+        EXPECT_EQ(1, d[k * k + j]);
+      }
+      for (uint32_t r = k; r < k + m; r++) {
+        EXPECT_EQ(1, d[r * k]);
+      }
+    }
+  }
+}
+
+TEST(erasure, k2_m1_is_xor) {
+  auto d = distribution_matrix(2, 1);
+  std::vector<uint8_t> expected{1, 0, 0, 1, 1, 1};
+  EXPECT_EQ(expected, d);
+}
+
+TEST(erasure, region_multiply) {
+  // unaligned lengths and offsets to cover the vector tails
+  std::vector<byte> source(1000);
+  for (size_t i = 0; i < source.size(); i++) {
+    source[i] = std::rand();
+  }
+  for (int c = 0; c < 256; c++) {
+    std::vector<byte> target(source.size(), 0x5a);
+    multiply_xor_region(c, &source[3], &target[1], 997);
+    EXPECT_EQ(0x5a, target[0]);
+    for (size_t i = 0; i < 997; i++) {
+      ASSERT_EQ(0x5a ^ gf_mul(c, source[i + 3]), target[i + 1]);
+    }
+  }
+}
+
+TEST(erasure, reconstruct) {
+  const uint32_t k = 8;
+  const uint32_t m = 3;
+  const size_t len = 4099;
+  std::vector<std::vector<byte>> fragments(k + m, std::vector<byte>(len));
+  std::vector<const byte *> data;
+  std::vector<byte *> parity;
+  for (uint32_t i = 0; i < k; i++) {
+    for (auto &b : fragments[i]) {
+      b = std::rand();
+    }
+    data.push_back(fragments[i].data());
+  }
+  for (uint32_t i = k; i < k + m; i++) {
+    parity.push_back(fragments[i].data());
+  }
+  encode(k, m, data, parity, len);
+
+  // lose fragments 0, 3 and 5: read 1 2 4 6 7 and two parity fragments
+  std::vector<uint32_t> available{1, 2, 4, 6, 7, 8, 10};
+  available.push_back(9);
+  std::vector<const byte *> sources;
+  for (auto f : available) {
+    sources.push_back(fragments[f].data());
+  }
+  for (uint32_t wanted : {0, 3, 5, 1}) {
+    auto coefficients = decoding_coefficients(k, m, available, wanted);
+    std::vector<byte> result(len);
+    combine(coefficients, sources, result.data(), len);
+    EXPECT_EQ(fragments[wanted], result);
+  }
+}
+
+TEST(erasure, replication) {
+  auto c = decoding_coefficients(1, 2, {2}, 0);
+  EXPECT_EQ(std::vector<uint8_t>{1}, c);
+}
@@ -0,0 +1,94 @@
+/*
+  Copyright (C) 2016 iNuron NV
+
+  This file is part of Open vStorage Open Source Edition (OSE), as available
+  from
+
+
+  http://www.openvstorage.org and
+  http://www.openvstorage.com.
+
+  This file is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Affero General Public License v3 (GNU AGPLv3)
+  as published by the Free Software Foundation, in version 3 as it comes
+  in the <LICENSE.txt> file of the Open vStorage OSE distribution.
+
+  Open vStorage is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY of any kind.
+*/
+
+#include "fragment_cache.h"
+#include "gtest/gtest.h"
+#include <unistd.h>
+
+using namespace alba::proxy_client;
+using alba::byte;
+
+namespace {
+std::vector<byte> make_data(size_t len, byte seed) {
+  std::vector<byte> data(len);
+  for (size_t i = 0; i < len; i++) {
+    data[i] = seed + i;
+  }
+  return data;
+}
+}
+
+TEST(fragment_cache, sub_ranges_hit) {
+  FragmentCache cache(1024);
+  auto data = make_data(100, 1);
+  cache.add("f", 200, 100, data.data());
+
+  std::vector<byte> target(50);
+  EXPECT_TRUE(cache.find("f", 220, 50, target.data()));
+  EXPECT_EQ(0, memcmp(target.data(), &data[20], 50));
+
+  EXPECT_FALSE(cache.find("f", 250, 100, target.data()));
+  EXPECT_FALSE(cache.find("g", 220, 50, target.data()));
+  EXPECT_EQ(1u, cache.hits());
+  EXPECT_EQ(2u, cache.misses());
+}
+
+TEST(fragment_cache, lru_eviction) {
+  FragmentCache cache(250);
+  auto data = make_data(100, 0);
+  std::vector<byte> target(100);
+  cache.add("a", 0, 100, data.data());
+  cache.add("b", 0, 100, data.data());
+  EXPECT_TRUE(cache.find("a", 0, 100, target.data()));
+  cache.add("c", 0, 100, data.data());
+
+  // b was the least recently used
+  EXPECT_TRUE(cache.find("a", 0, 100, target.data()));
+  EXPECT_FALSE(cache.find("b", 0, 100, target.data()));
+  EXPECT_TRUE(cache.find("c", 0, 100, target.data()));
+}
+
+TEST(fragment_cache, file_tier) {
+  char name[] = "/tmp/fragment_cache_test_XXXXXX";
+  int fd = mkstemp(name);
+  ASSERT_TRUE(fd >= 0);
+  close(fd);
+  {
+    FragmentCache cache(100, name, 250);
+    auto a = make_data(100, 1);
+    auto b = make_data(100, 2);
+    auto c = make_data(100, 3);
+    auto d = make_data(100, 4);
+    cache.add("a", 0, 100, a.data());
+    cache.add("b", 0, 100, b.data()); // a goes to the file
+
+    std::vector<byte> target(100);
+    EXPECT_TRUE(cache.find("a", 10, 20, target.data()));
+    EXPECT_EQ(0, memcmp(target.data(), &a[10], 20));
+
+    // the file ring holds 2 ranges, older ones get overwritten
+    cache.add("c", 0, 100, c.data());
+    cache.add("d", 0, 100, d.data());
+    cache.add("a", 0, 100, a.data());
+    EXPECT_TRUE(cache.find("c", 0, 100, target.data()));
+    EXPECT_EQ(0, memcmp(target.data(), c.data(), 100));
+    EXPECT_FALSE(cache.find("b", 0, 100, target.data()));
+  }
+  unlink(name);
+}
@@ -0,0 +1,337 @@
+/*
+  Copyright (C) 2016 iNuron NV
+
+  This file is part of Open vStorage Open Source Edition (OSE), as available
+  from
+
+
+  http://www.openvstorage.org and
+  http://www.openvstorage.com.
+
+  This file is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Affero General Public License v3 (GNU AGPLv3)
+  as published by the Free Software Foundation, in version 3 as it comes
+  in the <LICENSE.txt> file of the Open vStorage OSE distribution.
+
+  Open vStorage is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY of any kind.
+*/
+
+#include "manifest_cache.h"
+#include "gtest/gtest.h"
+#include <boost/optional/optional_io.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+using namespace alba::proxy_client;
+
+namespace {
+void fill_manifest(ManifestWithNamespaceId &mf, const std::string &name,
+                   int chunks, uint32_t version_id = 0) {
+  mf.name = name;
+  mf.object_id = "id_" + name;
+  mf.version_id = version_id;
+  mf.namespace_id.i = 7;
+  mf.encoding_scheme = EncodingScheme{2, 1, 8};
+  mf.compression.reset(new NoCompression());
+  mf.encrypt_info.reset(new alba::encryption::NoEncryption());
+  mf.checksum.reset(new alba::NoChecksum());
+  for (int i = 0; i < chunks; i++) {
+    mf.chunk_sizes.push_back(4096);
+    mf.fragments.emplace_back();
+    for (int j = 0; j < 3; j++) {
+      auto fragment = std::make_shared<Fragment>();
+      fragment->crc.reset(new alba::NoChecksum());
+      mf.fragments.back().push_back(fragment);
+    }
+  }
+}
+
+manifest_cache_entry make_manifest(const std::string &name, int chunks,
+                                   uint32_t version_id = 0) {
+  ManifestWithNamespaceId mf;
+  fill_manifest(mf, name, chunks, version_id);
+  return std::make_shared<const CompactManifest>(mf);
+}
+}
+
+TEST(manifest_cache, compact_manifest) {
+  ManifestWithNamespaceId mf;
+  fill_manifest(mf, "a", 2);
+  auto &fragment = *mf.fragments[1][2];
+  fragment.loc = fragment_location_t(alba::osd_t{5}, 3);
+  fragment.len = 2000;
+  fragment.ctr = std::string(16, 'c');
+  fragment.crc.reset(new alba::Crc32c(0x12345678));
+  mf.fragments[0][1]->loc = fragment_location_t(boost::none, 1);
+  std::string sha1(20, 's');
+  mf.fragments[1][0]->crc.reset(new alba::Sha1(sha1));
+
+  CompactManifest compact(mf);
+  EXPECT_EQ("a", compact.name);
+  EXPECT_EQ(3u, compact.fragment_count());
+
+  auto loc = compact.location(1, 2);
+  ASSERT_NE(boost::none, loc.first);
+  EXPECT_EQ(5u, loc.first->i);
+  EXPECT_EQ(3u, loc.second);
+  EXPECT_EQ(boost::none, compact.location(0, 1).first);
+  EXPECT_EQ(1u, compact.location(0, 1).second);
+  EXPECT_EQ(2000u, compact.fragment_length(1, 2));
+  EXPECT_EQ(std::string(16, 'c'), *compact.ctr(1, 2));
+  EXPECT_EQ(boost::none, compact.ctr(0, 0));
+
+  auto crc = compact.crc(1, 2);
+  ASSERT_EQ(alba::algo_t::CRC32c, crc->get_algo());
+  EXPECT_EQ(0x12345678u, static_cast<alba::Crc32c &>(*crc)._digest);
+  EXPECT_EQ(alba::algo_t::NO_CHECKSUM, compact.crc(0, 0)->get_algo());
+  crc = compact.crc(1, 0);
+  ASSERT_EQ(alba::algo_t::SHA1, crc->get_algo());
+  EXPECT_EQ(sha1, static_cast<alba::Sha1 &>(*crc)._digest);
+
+  for (uint32_t chunk_id = 0; chunk_id < 2; chunk_id++) {
+    for (uint32_t fragment_id = 0; fragment_id < 3; fragment_id++) {
+      EXPECT_EQ(fragment_key(mf.namespace_id, mf.object_id,
+                             compact.location(chunk_id, fragment_id).second,
+                             chunk_id, fragment_id),
+                compact.fragment_key(chunk_id, fragment_id));
+    }
+  }
+}
+
+TEST(manifest_cache, chunk_at) {
+  ManifestWithNamespaceId mf;
+  fill_manifest(mf, "a", 3);
+  mf.chunk_sizes[1] = 1000;
+  CompactManifest compact(mf);
+  EXPECT_EQ(0u, compact.chunk_at(0));
+  EXPECT_EQ(0u, compact.chunk_at(4095));
+  EXPECT_EQ(1u, compact.chunk_at(4096));
+  EXPECT_EQ(1u, compact.chunk_at(5095));
+  EXPECT_EQ(2u, compact.chunk_at(5096));
+  EXPECT_EQ(5096u, compact.chunk_offset(2));
+  EXPECT_EQ(3u, compact.chunk_at(9192));
+}
+
+TEST(manifest_cache, size_follows_chunks) {
+  EXPECT_LT(manifest_size(*make_manifest("a", 1)),
+            manifest_size(*make_manifest("a", 100)));
+}
+
+TEST(manifest_cache, byte_budget_across_namespaces) {
+  size_t small = manifest_size(*make_manifest("x", 1)) + 10;
+  ManifestCache cache(1000, 3 * small, 1);
+  cache.add("ns1", "alba", make_manifest("a", 1));
+  cache.add("ns2", "alba", make_manifest("b", 1));
+  cache.add("ns3", "alba", make_manifest("c", 1));
+  EXPECT_NE(nullptr, cache.find("ns1", "alba", "a"));
+
+  // ns2 wasn't used since it was added, ns1 was
+  cache.add("ns3", "alba", make_manifest("d", 1));
+  EXPECT_NE(nullptr, cache.find("ns1", "alba", "a"));
+  EXPECT_EQ(nullptr, cache.find("ns2", "alba", "b"));
+  EXPECT_NE(nullptr, cache.find("ns3", "alba", "c"));
+
+  auto occupancy = cache.get_occupancy();
+  EXPECT_EQ(0u, occupancy.count("ns2"));
+  EXPECT_EQ(2u, occupancy["ns3"].entries);
+  EXPECT_EQ(cache.total().bytes,
+            occupancy["ns1"].bytes + occupancy["ns3"].bytes);
+
+  // a big manifest pushes out several small ones
+  cache.add("ns1", "alba", make_manifest("big", 2));
+  EXPECT_LE(cache.total().bytes, 3 * small);
+  EXPECT_NE(nullptr, cache.find("ns1", "alba", "big"));
+}
+
+TEST(manifest_cache, invalidate_namespace) {
+  ManifestCache cache;
+  cache.add("ns1", "alba", make_manifest("a", 1));
+  cache.add("ns2", "alba", make_manifest("a", 1));
+  cache.invalidate_namespace("ns1");
+  EXPECT_EQ(nullptr, cache.find("ns1", "alba", "a"));
+  EXPECT_NE(nullptr, cache.find("ns2", "alba", "a"));
+  EXPECT_EQ(1u, cache.total().entries);
+}
+
+TEST(manifest_cache, invalidate_objects) {
+  ManifestCache cache;
+  cache.add("ns1", "alba", make_manifest("a", 1, 1));
+  cache.add("ns1", "alba", make_manifest("ab", 1, 2));
+  cache.add("ns1", "alba", make_manifest("b", 1, 3));
+  cache.add("ns1", "alba", make_manifest("c", 1, 4));
+  cache.add("ns2", "alba", make_manifest("a", 1, 1));
+
+  EXPECT_TRUE(cache.invalidate("ns1", "alba", "c"));
+  EXPECT_FALSE(cache.invalidate("ns1", "alba", "c"));
+  EXPECT_EQ(nullptr, cache.find("ns1", "alba", "c"));
+
+  EXPECT_EQ(2u, cache.invalidate_prefix("ns1", "a"));
+  EXPECT_EQ(nullptr, cache.find("ns1", "alba", "ab"));
+  EXPECT_NE(nullptr, cache.find("ns1", "alba", "b"));
+  EXPECT_NE(nullptr, cache.find("ns2", "alba", "a"));
+
+  cache.add("ns1", "alba", make_manifest("a", 1, 1));
+  EXPECT_EQ(1u, cache.invalidate_older("ns1", 3));
+  EXPECT_EQ(nullptr, cache.find("ns1", "alba", "a"));
+  EXPECT_NE(nullptr, cache.find("ns1", "alba", "b"));
+  EXPECT_EQ(2u, cache.total().entries);
+}
+
+TEST(manifest_cache, serialized_entries) {
+  ManifestCache cache;
+  auto serialized = std::make_shared<SerializedManifest>();
+  serialized->namespace_id.i = 7;
+  // an unknown manifest version
+  serialized->data = alba::llio::message_buffer::of_size(5);
+  memset(serialized->data->data(0), 0, 5);
+  serialized->data->data(0)[0] = 99;
+
+  cache.add("ns1", "alba", "a", serialized);
+  EXPECT_EQ(1u, cache.total().entries);
+  EXPECT_EQ(manifest_size(*serialized) + 7, cache.total().bytes);
+
+  // decoded on first use, and dropped when that fails
+  EXPECT_EQ(nullptr, cache.find("ns1", "alba", "a"));
+  EXPECT_EQ(0u, cache.total().entries);
+  EXPECT_EQ(0u, cache.total().bytes);
+}
+
+TEST(manifest_cache, snapshot) {
+  auto serialized = std::make_shared<SerializedManifest>();
+  serialized->namespace_id.i = 7;
+  serialized->data = alba::llio::message_buffer::of_size(3);
+  memcpy(serialized->data->data(0), "abc", 3);
+
+  std::string path = "/tmp/manifest_cache_test.snapshot";
+  {
+    ManifestCache cache;
+    cache.add("ns1", "alba", "a", serialized);
+    cache.add("ns1", "other_alba", "b", serialized);
+    cache.add("ns2", "alba", make_manifest("c", 1));
+    // only the serialized form can be written
+    EXPECT_EQ(2u, cache.save(path));
+  }
+
+  ManifestCache cache;
+  EXPECT_EQ(1u, cache.load(path, {"alba"}));
+  EXPECT_EQ(1u, cache.get_occupancy()["ns1"].entries);
+  EXPECT_EQ(manifest_size(*serialized) + 7, cache.total().bytes);
+
+  // too old to trust
+  std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+  ManifestCache stale;
+  EXPECT_EQ(0u, stale.load(path, {"alba"}, std::chrono::seconds(0)));
+  EXPECT_EQ(0u, stale.total().entries);
+  std::remove(path.c_str());
+}
+
+TEST(manifest_cache, stop_snapshots) {
+  auto serialized = std::make_shared<SerializedManifest>();
+  serialized->namespace_id.i = 7;
+  serialized->data = alba::llio::message_buffer::of_size(3);
+  memcpy(serialized->data->data(0), "abc", 3);
+
+  std::string path = "/tmp/manifest_cache_test.stop";
+  std::remove(path.c_str());
+  {
+    ManifestCache cache;
+    EXPECT_EQ(0u, cache.stop_snapshots());
+    cache.start_snapshots(path, std::chrono::seconds(3600), {"alba"});
+    cache.add("ns1", "alba", "a", serialized);
+    EXPECT_EQ(1u, cache.stop_snapshots());
+    EXPECT_EQ(0u, cache.stop_snapshots());
+    cache.add("ns1", "alba", "b", serialized);
+  }
+  // nothing more was written when the cache went away
+  ManifestCache cache;
+  EXPECT_EQ(1u, cache.load(path, {"alba"}));
+  std::remove(path.c_str());
+}
+
+TEST(manifest_cache, concurrent_saves) {
+  auto serialized = std::make_shared<SerializedManifest>();
+  serialized->namespace_id.i = 7;
+  serialized->data = alba::llio::message_buffer::of_size(1000);
+  memset(serialized->data->data(0), 'x', 1000);
+
+  std::string path = "/tmp/manifest_cache_test.concurrent";
+  ManifestCache cache;
+  for (int i = 0; i < 100; i++) {
+    cache.add("ns", "alba", "object_" + std::to_string(i), serialized);
+  }
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([&cache, &path]() {
+      for (int j = 0; j < 10; j++) {
+        EXPECT_EQ(100u, cache.save(path));
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  ManifestCache loaded;
+  EXPECT_EQ(100u, loaded.load(path, {"alba"}));
+  std::remove(path.c_str());
+}
+
+TEST(manifest_cache, concurrent_find_and_add) {
+  ManifestCache cache(100, 1 << 30, 4);
+  std::vector<manifest_cache_entry> manifests;
+  for (int i = 0; i < 200; i++) {
+    manifests.push_back(make_manifest(std::to_string(i), 1));
+  }
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; t++) {
+    threads.emplace_back([&cache, &manifests, t]() {
+      for (int i = 0; i < 10000; i++) {
+        auto &mf = manifests[(i * 7 + t) % manifests.size()];
+        if (i % 4 == 0) {
+          cache.add("ns", "alba", mf);
+        } else {
+          auto found = cache.find("ns", "alba", mf->name);
+          if (found != nullptr) {
+            EXPECT_EQ(mf->name, found->name);
+          }
+        }
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  EXPECT_LE(cache.total().entries, 100u);
+}
+
+// run with --gtest_also_run_disabled_tests
+TEST(manifest_cache, DISABLED_thread_scaling) {
+  ManifestCache cache;
+  std::vector<std::string> names;
+  for (int i = 0; i < 10000; i++) {
+    names.push_back(std::to_string(i));
+    cache.add("ns", "alba", make_manifest(names.back(), 1));
+  }
+  for (int n_threads = 1; n_threads <= 32; n_threads *= 2) {
+    const int lookups = 1000000;
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < n_threads; t++) {
+      threads.emplace_back([&cache, &names, t]() {
+        for (int i = 0; i < lookups; i++) {
+          cache.find("ns", "alba", names[(i + t * 997) % names.size()]);
+        }
+      });
+    }
+    for (auto &t : threads) {
+      t.join();
+    }
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - t0;
+    std::cout << n_threads << " threads: "
+              << (n_threads * lookups / d.count() / 1e6) << " M lookups/s"
+              << std::endl;
+  }
+}
@@ -0,0 +1,76 @@
+/*
+  Copyright (C) 2016 iNuron NV
+
+  This file is part of Open vStorage Open Source Edition (OSE), as available
+  from
+
+
+  http://www.openvstorage.org and
+  http://www.openvstorage.com.
+
+  This file is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Affero General Public License v3 (GNU AGPLv3)
+  as published by the Free Software Foundation, in version 3 as it comes
+  in the <LICENSE.txt> file of the Open vStorage OSE distribution.
+
+  Open vStorage is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY of any kind.
+*/
+
+#include "osd_access.h"
+#include "gtest/gtest.h"
+
+using namespace alba::proxy_client;
+using alba::byte;
+
+TEST(osd_access, plan_key_reads_groups_per_key) {
+  std::vector<byte> buf(300);
+  std::vector<asd_slice> slices{{"a", 0, 100, &buf[0]},
+                                {"b", 0, 100, &buf[100]},
+                                {"a", 500, 100, &buf[200]}};
+  auto plan = plan_key_reads(slices);
+  ASSERT_EQ(2u, plan.size());
+  EXPECT_EQ("a", plan[0].key);
+  EXPECT_EQ(2u, plan[0].slices.size());
+  EXPECT_EQ("b", plan[1].key);
+  EXPECT_EQ(1u, plan[1].slices.size());
+  EXPECT_EQ(0u, plan[0].copies.size());
+}
+
+TEST(osd_access, plan_key_reads_merges_contiguous) {
+  std::vector<byte> buf(300);
+  // out of order, adjacent in the fragment and in memory
+  std::vector<asd_slice> slices{{"a", 200, 100, &buf[200]},
+                                {"a", 0, 100, &buf[0]},
+                                {"a", 100, 100, &buf[100]}};
+  auto plan = plan_key_reads(slices);
+  ASSERT_EQ(1u, plan.size());
+  ASSERT_EQ(1u, plan[0].slices.size());
+  EXPECT_EQ(0u, plan[0].slices[0].offset);
+  EXPECT_EQ(300u, plan[0].slices[0].length);
+  EXPECT_EQ(&buf[0], plan[0].slices[0].target);
+  EXPECT_EQ(0u, plan[0].copies.size());
+}
+
+TEST(osd_access, plan_key_reads_overlap_uses_scratch) {
+  std::vector<byte> x(100);
+  std::vector<byte> y(100);
+  std::vector<asd_slice> slices{{"a", 0, 100, &x[0]}, {"a", 50, 100, &y[0]}};
+  auto plan = plan_key_reads(slices);
+  ASSERT_EQ(1u, plan.size());
+  auto &kr = plan[0];
+  ASSERT_EQ(1u, kr.slices.size());
+  EXPECT_EQ(0u, kr.slices[0].offset);
+  EXPECT_EQ(150u, kr.slices[0].length);
+  ASSERT_EQ(2u, kr.copies.size());
+
+  // pretend the asd returned bytes equal to their offset
+  for (uint32_t i = 0; i < 150; i++) {
+    kr.slices[0].target[i] = i;
+  }
+  kr.finish();
+  for (uint32_t i = 0; i < 100; i++) {
+    EXPECT_EQ(i, x[i]);
+    EXPECT_EQ(i + 50, y[i]);
+  }
+}
@@ -29,6 +29,7 @@ but WITHOUT ANY WARRANTY of any kind.
 #include "manifest_cache.h"
 #include "osd_access.h"
 #include "osd_info.h"
+#include "rora_proxy_client.h"
 
 #include <fstream>
 #include <iostream>
@@ -553,12 +554,11 @@ TEST(proxy_client, test_partial_read_full_object) {
   istringstream input(result);
   read_json(input, pt);
 
-  const vector<alba_id_t> &alba_levels =
-      OsdAccess::getInstance(5, std::chrono::seconds(1))
-          .get_alba_levels(*client);
+  auto alba_levels = OsdAccess::getInstance(5, std::chrono::seconds(1))
+                         .get_alba_levels(*client);
 
   ManifestCache &mfc = ManifestCache::getInstance();
-  auto alba_id = alba_levels[0];
+  auto alba_id = alba_levels->at(0);
   ALBA_LOG(DEBUG, "alba_id " << alba_id);
   auto entry = mfc.find(namespace_, alba_id, name);
   auto pt_r = pt.get_child("result");
@@ -572,12 +572,11 @@ TEST(proxy_client, test_partial_read_full_object) {
     for (auto js_fr = chunk->second.begin(); js_fr != chunk->second.end();
          ++js_fr) {
 
-      auto mf_fr = entry->fragments[chunk_index][fragment_index];
-      int mf_len = mf_fr->len;
+      int mf_len = entry->fragment_length(chunk_index, fragment_index);
       int js_len = js_fr->second.get<int>("len");
 
       ASSERT_EQ(mf_len, js_len);
-      auto mf_loc = mf_fr->loc;
+      auto mf_loc = entry->location(chunk_index, fragment_index);
       boost::optional<osd_t> mf_osd_o = std::get<0>(mf_loc);
 
       if (boost::none != mf_osd_o) {
@@ -594,7 +593,7 @@ TEST(proxy_client, test_partial_read_full_object) {
       ASSERT_EQ(mf_version, js_version);
 
       // "crc": [ "Crc32c", "0xc1103e5c" ],
-      shared_ptr<Checksum> mf_crc = mf_fr->crc;
+      shared_ptr<Checksum> mf_crc = entry->crc(chunk_index, fragment_index);
       alba::algo_t mf_crc_algo = mf_crc->get_algo();
       auto js_crc = js_fr->second.get_child("crc");
 
@@ -625,19 +624,48 @@ TEST(proxy_client, test_partial_read_full_object) {
 
       ASSERT_EQ(mf_digest_s, js_digest);
 
-      //"fnr": "\u0004\u0000\u0000\u0000\u0000\u0000\u0000\u0000"
-      ostringstream mf_fnr_ss;
-      dump_string_option(mf_fnr_ss, mf_fr->fnr);
-
-      auto mf_fnr_s = mf_fnr_ss.str();
-      ALBA_LOG(DEBUG, "mf_fnr =" << mf_fnr_s);
-
       fragment_index++;
     }
     chunk_index++;
   }
 }
 
+TEST(proxy_client, reconstruction_sources) {
+  using namespace alba::proxy_client;
+  ManifestWithNamespaceId mf;
+  mf.name = "w";
+  mf.object_id = "id_w";
+  mf.namespace_id.i = 7;
+  mf.compression.reset(new NoCompression());
+  mf.encrypt_info.reset(new alba::encryption::NoEncryption());
+  mf.checksum.reset(new alba::NoChecksum());
+  mf.chunk_sizes.push_back(4096);
+  mf.fragments.emplace_back();
+  for (uint32_t j = 0; j < 3; j++) {
+    auto fragment = std::make_shared<Fragment>();
+    fragment->crc.reset(new alba::NoChecksum());
+    // fragment 0 is missing
+    fragment->loc = fragment_location_t(
+        j == 0 ? boost::none : boost::optional<osd_t>(osd_t{j}), 0);
+    mf.fragments.back().push_back(fragment);
+  }
+  auto readable = [](const fragment_location_t &loc) {
+    return loc.first != boost::none;
+  };
+
+  Location l;
+  l.chunk_id = 0;
+  l.fragment_id = 0;
+  mf.encoding_scheme = EncodingScheme{2, 1, 8};
+  l.manifest = std::make_shared<const CompactManifest>(mf);
+  EXPECT_EQ((std::vector<uint32_t>{1, 2}), reconstruction_sources(l, readable));
+
+  // only GF(2^8) can be decoded here, w=16 goes through the proxy
+  mf.encoding_scheme = EncodingScheme{2, 1, 16};
+  l.manifest = std::make_shared<const CompactManifest>(mf);
+  EXPECT_TRUE(reconstruction_sources(l, readable).empty());
+}
+
 TEST(proxy_client, manifest_cache_eviction) {
   config cfg;
   std::string namespace_("manifest_cache_eviction");
@@ -657,6 +685,92 @@ TEST(proxy_client, manifest_cache_eviction) {
   }
 }
 
+TEST(proxy_client, prefetch_manifests) {
+  config cfg;
+  std::ostringstream nos;
+  nos << "prefetch_manifests_" << std::rand();
+  string namespace_{nos.str()};
+  string file("./ocaml/alba.native");
+  std::vector<string> names{"object_0", "object_1", "object_2"};
+  {
+    auto client =
+        make_proxy_client(cfg.HOST, cfg.PORT, TIMEOUT, cfg.TRANSPORT);
+    boost::optional<std::string> preset{"preset_rora"};
+    client->create_namespace(namespace_, preset);
+    for (auto &name : names) {
+      client->write_object_fs(namespace_, name, file,
+                              proxy_client::allow_overwrite::T, nullptr);
+    }
+  }
+
+  boost::optional<alba::proxy_client::RoraConfig> rora_config{100};
+  auto client = make_proxy_client(cfg.HOST, cfg.PORT, TIMEOUT, cfg.TRANSPORT,
+                                  rora_config);
+  std::vector<string> with_missing(names);
+  with_missing.push_back("missing");
+  EXPECT_EQ(3u, client->prefetch_manifests(namespace_, with_missing));
+  EXPECT_EQ(3u, client->prefetch_manifests(namespace_, "",
+                                           proxy_client::include_first::T,
+                                           boost::none,
+                                           proxy_client::include_last::T));
+
+  using namespace proxy_protocol;
+  std::vector<byte> bytes(4096);
+  SliceDescriptor sd{&bytes[0], 0, 4096};
+  std::vector<SliceDescriptor> slices{sd};
+  ObjectSlices object_slices{names[1], slices};
+  alba::statistics::RoraCounter cntr;
+  client->read_objects_slices(namespace_, {object_slices},
+                              proxy_client::consistent_read::F, cntr);
+  if (env_or_default("ALBA_TEST_SLOW_ALLOWED", "false") != "true") {
+    EXPECT_EQ(cntr.slow_path, 0);
+    EXPECT_TRUE(cntr.fast_path > 0);
+  }
+}
+
+TEST(proxy_client, validate_consistent_reads) {
+  config cfg;
+  std::ostringstream nos;
+  nos << "validate_consistent_reads_" << std::rand();
+  string namespace_{nos.str()};
+  string name("object");
+  boost::optional<alba::proxy_client::RoraConfig> rora_config{100};
+  rora_config->validate_consistent_reads = true;
+  auto client = make_proxy_client(cfg.HOST, cfg.PORT, TIMEOUT, cfg.TRANSPORT,
+                                  rora_config);
+  auto other = make_proxy_client(cfg.HOST, cfg.PORT, TIMEOUT, cfg.TRANSPORT);
+  boost::optional<std::string> preset{"preset_rora"};
+  client->create_namespace(namespace_, preset);
+
+  using namespace proxy_protocol;
+  auto write_barrier = proxy_client::write_barrier::F;
+  std::string blob_a(4096, 'a');
+  client->apply_sequence(
+      namespace_, write_barrier,
+      proxy_client::sequences::Sequence().add_upload(
+          name, (const uint8_t *)blob_a.data(), blob_a.size(), nullptr));
+
+  std::vector<byte> bytes(4096);
+  auto read = [&]() {
+    SliceDescriptor sd{&bytes[0], 0, 4096};
+    ObjectSlices object_slices{name, {sd}};
+    alba::statistics::RoraCounter cntr;
+    client->read_objects_slices(namespace_, {object_slices},
+                                proxy_client::consistent_read::T, cntr);
+    return std::string(bytes.begin(), bytes.end());
+  };
+  EXPECT_EQ(blob_a, read());
+
+  // overwritten behind the client's back: its manifest is outdated
+  std::string blob_b(4096, 'b');
+  other->apply_sequence(
+      namespace_, write_barrier,
+      proxy_client::sequences::Sequence().add_upload(
+          name, (const uint8_t *)blob_b.data(), blob_b.size(), nullptr));
+  EXPECT_EQ(blob_b, read());
+  EXPECT_EQ(blob_b, read());
+}
+
 TEST(proxy_client, test_partial_read_fc) {
   std::string namespace_("test_partial_read_fc");
   std::ostringstream sos;
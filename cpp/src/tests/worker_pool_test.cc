@@ -0,0 +1,66 @@
+/*
+  Copyright (C) 2016 iNuron NV
+
+  This file is part of Open vStorage Open Source Edition (OSE), as available
+  from
+
+
+  http://www.openvstorage.org and
+  http://www.openvstorage.com.
+
+  This file is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Affero General Public License v3 (GNU AGPLv3)
+  as published by the Free Software Foundation, in version 3 as it comes
+  in the <LICENSE.txt> file of the Open vStorage OSE distribution.
+
+  Open vStorage is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY of any kind.
+*/
+
+#include "worker_pool.h"
+#include "gtest/gtest.h"
+#include <atomic>
+#include <stdexcept>
+
+using namespace alba::worker_pool;
+
+TEST(worker_pool, run_all) {
+  WorkerPool pool(4);
+  std::vector<int> results(100, 0);
+  std::vector<std::function<void()>> tasks;
+  for (int i = 0; i < 100; i++) {
+    tasks.push_back([&results, i]() { results[i] = i * i; });
+  }
+  pool.run(tasks);
+  for (int i = 0; i < 100; i++) {
+    EXPECT_EQ(i * i, results[i]);
+  }
+}
+
+TEST(worker_pool, no_threads) {
+  WorkerPool pool(0);
+  std::atomic<int> count(0);
+  std::vector<std::function<void()>> tasks;
+  for (int i = 0; i < 10; i++) {
+    tasks.push_back([&count]() { count++; });
+  }
+  pool.run(tasks);
+  EXPECT_EQ(10, count.load());
+}
+
+TEST(worker_pool, exception) {
+  WorkerPool pool(2);
+  std::atomic<int> count(0);
+  std::vector<std::function<void()>> tasks;
+  for (int i = 0; i < 10; i++) {
+    tasks.push_back([&count, i]() {
+      count++;
+      if (i == 5) {
+        throw std::runtime_error("task 5");
+      }
+    });
+  }
+  EXPECT_THROW(pool.run(tasks), std::runtime_error);
+  // the other tasks still ran
+  EXPECT_EQ(10, count.load());
+}